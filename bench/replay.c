@@ -0,0 +1,415 @@
+/******************************************************************************
+ * FILENAME: replay.c
+ * PROVIDES: Replays an allocation trace against every POLICY of libmem and
+ *           against glibc malloc, and reports how each of them holds up.
+ *
+ * A trace is a text file with one operation per line:
+ *
+ *     a <id> <size>    allocate size bytes and call the block id
+ *     r <id> <size>    resize block id to size bytes
+ *     f <id>           free block id
+ *
+ * Ids are any non-negative numbers and may be reused once freed.  Blank
+ * lines and lines starting with '#' are skipped.
+ *
+ * Utilization is payload / (payload + padding + headers) of the blocks in
+ * use, the figures Mem_Dump prints, taken when the live size of the trace
+ * peaks.  glibc does not tell its headers and padding apart, so its
+ * payload is the live size of the trace and the rest is what mallinfo2
+ * reports in use beyond it.  The harness' own buffers come from glibc too
+ * and are taken out of its figures.
+ *
+ * usage: replay [-s heap_size] [-m max_heap_size] trace
+ *        replay -g ops > trace      writes a random trace to play with
+ * *****************************************************************************/
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define DEFAULT_HEAP_SIZE (1 << 20)
+#define DEFAULT_MAX_SIZE (1 << 30)
+#define GLIBC -1  // allocator number of glibc malloc, the others are POLICY values
+
+/**
+ ** An OP is one line of the trace.  The ids of the trace are mapped to
+ ** slots 0 .. slot_count-1 while parsing, so replaying only indexes an array.
+ */
+typedef struct OP {
+    char type;      // 'a', 'r' or 'f'
+    unsigned slot;  // slot of the block
+    int size;       // size for 'a' and 'r'
+} OP;
+
+typedef struct TRACE {
+    OP *ops;
+    int op_count;
+    unsigned slot_count;
+    long long peak_live;  // most bytes the trace holds at once
+} TRACE;
+
+typedef struct RESULT {
+    double seconds;            // time taken by the replay
+    long long peak_footprint;  // most memory the allocator held at once
+    double utilization;        // payload over the bytes of the blocks in use, at the live peak
+    double fragmentation;      // fragmentation left at the end, negative if not known
+    int failed;                // operations that returned NULL
+} RESULT;
+
+const char *allocator_names[] = {"BEST_FIT", "FIRST_FIT", "NEXT_FIT", "WORST_FIT", "TLSF"};
+int heap_size = DEFAULT_HEAP_SIZE;
+int max_size = DEFAULT_MAX_SIZE;
+struct mallinfo2 glibc_baseline;  // what glibc holds for the harness before a replay starts
+
+// #################################################################################
+// ###############                 Trace Parsing                ####################
+// #################################################################################
+
+/**
+ ** Ids are mapped to slots through an open addressing table that doubles
+ ** when half full.  A freed id keeps its slot, so a reused id needs no new one.
+ */
+typedef struct ID_TABLE {
+    unsigned long *ids;
+    unsigned *slots;
+    unsigned capacity;  // a power of two
+    unsigned count;
+} ID_TABLE;
+
+unsigned Id_Hash(unsigned long id) { return (unsigned)(id * 0x9E3779B97F4A7C15UL >> 32); }
+
+/**
+ * @brief Finds the slot of an id, handing out a new one for an id not seen before
+ *
+ * @param table table of the ids seen so far
+ * @param id    id from the trace
+ * @return      slot of the id
+ */
+unsigned Id_Slot(ID_TABLE *table, unsigned long id) {
+    unsigned i;
+
+    if (table->count * 2 >= table->capacity) {
+        ID_TABLE grown = {NULL, NULL, table->capacity ? table->capacity * 2 : 1024, 0};
+
+        grown.ids = malloc(grown.capacity * sizeof(unsigned long));
+        grown.slots = malloc(grown.capacity * sizeof(unsigned));
+        memset(grown.slots, 0xff, grown.capacity * sizeof(unsigned));
+        for (i = 0; i < table->capacity; i++) {
+            if (table->slots[i] == ~0U) continue;
+            unsigned j = Id_Hash(table->ids[i]) & (grown.capacity - 1);
+            while (grown.slots[j] != ~0U) j = (j + 1) & (grown.capacity - 1);
+            grown.ids[j] = table->ids[i];
+            grown.slots[j] = table->slots[i];
+        }
+        grown.count = table->count;
+        free(table->ids);
+        free(table->slots);
+        *table = grown;
+    }
+
+    for (i = Id_Hash(id) & (table->capacity - 1); table->slots[i] != ~0U;
+         i = (i + 1) & (table->capacity - 1))
+        if (table->ids[i] == id) return table->slots[i];
+    table->ids[i] = id;
+    table->slots[i] = table->count;
+    return table->count++;
+}
+
+/**
+ * @brief Reads a trace file and checks that it never frees what it does not hold
+ *
+ * @param path  trace file
+ * @param trace filled in with the operations
+ * @return      0 on success, -1 on a bad file, after printing where it went wrong
+ */
+int Trace_Read(const char *path, TRACE *trace) {
+    ID_TABLE table = {NULL, NULL, 0, 0};
+    FILE *file = fopen(path, "r");
+    char line[256];
+    int capacity = 0;
+    int line_no = 0;
+    long long live = 0;
+    int *sizes = NULL;  // live size per slot, -1 for none
+    unsigned sizes_capacity = 0;
+
+    if (file == NULL) {
+        fprintf(stderr, "replay: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    memset(trace, 0, sizeof(TRACE));
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        OP op = {0, 0, 0};
+        unsigned long id;
+        int fields;
+
+        line_no++;
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') continue;
+        fields = sscanf(line, " %c %lu %d", &op.type, &id, &op.size);
+        if (fields < 2 || (op.type == 'f' ? 0 : fields < 3 || op.size < 1) ||
+            strchr("arf", op.type) == NULL) {
+            fprintf(stderr, "replay: %s:%d: bad operation\n", path, line_no);
+            return -1;
+        }
+        op.slot = Id_Slot(&table, id);
+
+        if (op.slot == sizes_capacity) {
+            sizes_capacity = sizes_capacity ? sizes_capacity * 2 : 1024;
+            sizes = realloc(sizes, sizes_capacity * sizeof(int));
+            memset(sizes + op.slot, 0xff, (sizes_capacity - op.slot) * sizeof(int));
+        }
+        if ((op.type == 'a') != (sizes[op.slot] < 0)) {
+            fprintf(stderr, "replay: %s:%d: block %lu is %s\n", path, line_no, id,
+                    op.type == 'a' ? "already allocated" : "not allocated");
+            return -1;
+        }
+        live += (op.type == 'f' ? 0 : op.size) - (op.type == 'a' ? 0 : sizes[op.slot]);
+        sizes[op.slot] = op.type == 'f' ? -1 : op.size;
+        if (live > trace->peak_live) trace->peak_live = live;
+
+        if (trace->op_count == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            trace->ops = realloc(trace->ops, capacity * sizeof(OP));
+        }
+        trace->ops[trace->op_count++] = op;
+    }
+    fclose(file);
+    trace->slot_count = table.count;
+    free(table.ids);
+    free(table.slots);
+    free(sizes);
+    return 0;
+}
+
+/**
+ * @brief Writes a random trace with a mix of short and long lived blocks to stdout
+ *
+ * @param ops   number of operations
+ */
+void Trace_Generate(int ops) {
+    int live[4096];
+    int count = 0;
+    int next_id = 0;
+
+    srand(354);
+    printf("# random trace, %d operations\n", ops);
+    for (int i = 0; i < ops; i++) {
+        int r = rand() % 100;
+        int size = rand() % 8 ? rand() % 128 + 1 : rand() % 8192 + 1;
+
+        if (rand() % 200 == 0) size = rand() % (512 * 1024) + 1;
+        if (count > 0 && (r < 40 || count == 4096)) {
+            int k = rand() % count;
+            printf("f %d\n", live[k]);
+            live[k] = live[--count];
+        } else if (count > 0 && r < 50) {
+            printf("r %d %d\n", live[rand() % count], size);
+        } else {
+            printf("a %d %d\n", next_id, size);
+            live[count++] = next_id++;
+        }
+    }
+    while (count > 0) printf("f %d\n", live[--count]);
+}
+
+// #################################################################################
+// ###############                    Replay                    ####################
+// #################################################################################
+
+/**
+ * Returns the memory the allocator holds right now, the harness' own buffers left out
+ */
+long long Footprint(MEM_ARENA *arena) {
+    MEM_STATS stats;
+
+    if (arena == NULL) {
+        struct mallinfo2 info = mallinfo2();
+        return (long long)(info.arena + info.hblkhd) -
+               (long long)(glibc_baseline.arena + glibc_baseline.hblkhd);
+    }
+    Mem_Arena_Get_Stats(arena, &stats);
+    return stats.heap_size + stats.mapped_size;
+}
+
+/**
+ * @brief Returns payload / (payload + padding + headers) of the blocks in use, as in Mem_Dump
+ *
+ * @param live  bytes the trace holds right now, the payload for glibc
+ */
+double Utilization(MEM_ARENA *arena, long long live) {
+    MEM_STATS stats;
+    long long used;
+
+    if (arena == NULL) {
+        struct mallinfo2 info = mallinfo2();
+        used = (long long)(info.uordblks + info.hblkhd) -
+               (long long)(glibc_baseline.uordblks + glibc_baseline.hblkhd);
+        return used > 0 ? (double)live / used : 0;
+    }
+    Mem_Arena_Get_Stats(arena, &stats);
+    used = stats.bytes_in_use + stats.padding_bytes + stats.header_bytes;
+    return used > 0 ? (double)stats.bytes_in_use / used : 0;
+}
+
+/**
+ * @brief Replays a trace against one allocator
+ *
+ * The footprint is read after every operation, which is not free, so the
+ * timed replay does not measure it: with 'measure' set the replay only
+ * tracks the footprint, without it only the time.
+ *
+ * @param trace     trace to replay
+ * @param allocator a POLICY, or GLIBC
+ * @param measure   track the footprint instead of the time
+ * @param result    filled in with what was measured
+ */
+void Replay(TRACE *trace, int allocator, int measure, RESULT *result) {
+    MEM_ARENA *arena = NULL;
+    char **blocks = calloc(trace->slot_count, sizeof(char *));
+    int *sizes = calloc(trace->slot_count, sizeof(int));  // size of each block held, 0 for none
+    struct timespec start;
+    struct timespec end;
+    long long footprint;
+    long long live = 0;
+    long long peak_live = 0;
+
+    memset(result, 0, sizeof(RESULT));
+    result->fragmentation = -1;
+    if (allocator != GLIBC) {
+        arena = Mem_Arena_Create(heap_size, allocator);
+        if (arena == NULL || Mem_Arena_Set_Max_Size(arena, max_size) != 0) {
+            fprintf(stderr, "replay: could not create the arena\n");
+            exit(1);
+        }
+    }
+    glibc_baseline = mallinfo2();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < trace->op_count; i++) {
+        OP *op = &trace->ops[i];
+        int old_size = sizes[op->slot];
+        char *p;
+
+        switch (op->type) {
+            case 'a':
+                p = arena ? Mem_Arena_Alloc(arena, op->size) : malloc(op->size);
+                if (p == NULL) result->failed++;
+                if (p != NULL) p[0] = 1;  // touch the block like a real program would
+                blocks[op->slot] = p;
+                sizes[op->slot] = p != NULL ? op->size : 0;
+                break;
+            case 'r':
+                if (blocks[op->slot] == NULL) break;
+                p = arena ? Mem_Arena_Realloc(arena, blocks[op->slot], op->size)
+                          : realloc(blocks[op->slot], op->size);
+                if (p == NULL) {
+                    result->failed++;
+                } else {
+                    blocks[op->slot] = p;
+                    sizes[op->slot] = op->size;
+                }
+                break;
+            default:
+                if (arena)
+                    Mem_Arena_Free(arena, blocks[op->slot]);
+                else
+                    free(blocks[op->slot]);
+                blocks[op->slot] = NULL;
+                sizes[op->slot] = 0;
+        }
+        if (!measure) continue;
+
+        if ((footprint = Footprint(arena)) > result->peak_footprint)
+            result->peak_footprint = footprint;
+        if ((live += sizes[op->slot] - old_size) > peak_live) {
+            peak_live = live;
+            result->utilization = Utilization(arena, live);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result->seconds = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (arena != NULL) result->fragmentation = Mem_Arena_Fragmentation(arena);
+    free(blocks);
+    free(sizes);
+}
+
+/**
+ * @brief Runs a replay in a child process, so every allocator starts out fresh
+ *
+ * @return  0 on success, -1 if the child failed
+ */
+int Replay_Isolated(TRACE *trace, int allocator, int measure, RESULT *result) {
+    int fds[2];
+    int status;
+    pid_t pid;
+
+    if (pipe(fds) != 0 || (pid = fork()) < 0) return -1;
+    if (pid == 0) {
+        close(fds[0]);
+        Replay(trace, allocator, measure, result);
+        _exit(write(fds[1], result, sizeof(RESULT)) == sizeof(RESULT) ? 0 : 1);
+    }
+    close(fds[1]);
+    status = read(fds[0], result, sizeof(RESULT)) == sizeof(RESULT) ? 0 : -1;
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return status;
+}
+
+int main(int argc, char **argv) {
+    TRACE trace;
+    RESULT timed;
+    RESULT measured;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:m:g:")) != -1) {
+        switch (opt) {
+            case 's': heap_size = atoi(optarg); break;
+            case 'm': max_size = atoi(optarg); break;
+            case 'g': Trace_Generate(atoi(optarg)); return 0;
+            default:
+                fprintf(stderr, "usage: %s [-s heap_size] [-m max_heap_size] trace\n"
+                                "       %s -g ops > trace\n", argv[0], argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || heap_size <= 0 || max_size < heap_size) {
+        fprintf(stderr, "usage: %s [-s heap_size] [-m max_heap_size] trace\n", argv[0]);
+        return 1;
+    }
+    if (Trace_Read(argv[optind], &trace) != 0) return 1;
+
+    printf("%d operations, %u blocks, peak live size %lld bytes\n", trace.op_count,
+           trace.slot_count, trace.peak_live);
+    printf("utilization is payload / (payload + padding + headers) at the live peak, as in "
+           "Mem_Dump\n\n");
+    printf("%-10s %14s %16s %12s %14s %8s\n", "Allocator", "Ops/sec", "Peak footprint",
+           "Utilization", "Fragmentation", "Failed");
+    for (int allocator = BEST_FIT; allocator <= TLSF + 1; allocator++) {
+        int which = allocator > TLSF ? GLIBC : allocator;
+        char fragmentation[16] = "-";
+
+        if (Replay_Isolated(&trace, which, 0, &timed) != 0 ||
+            Replay_Isolated(&trace, which, 1, &measured) != 0) {
+            fprintf(stderr, "replay: replay against %s failed\n",
+                    which == GLIBC ? "glibc" : allocator_names[which]);
+            continue;
+        }
+        if (measured.fragmentation >= 0)
+            snprintf(fragmentation, sizeof(fragmentation), "%.2f%%", 100 * measured.fragmentation);
+        printf("%-10s %14.0f %16lld %11.2f%% %14s %8d\n",
+               which == GLIBC ? "glibc" : allocator_names[which],
+               timed.seconds > 0 ? trace.op_count / timed.seconds : 0, measured.peak_footprint,
+               100 * measured.utilization, fragmentation, timed.failed);
+    }
+    free(trace.ops);
+    return 0;
+}
@@ -7,17 +7,23 @@
  * *****************************************************************************/
 //Project by James Zhang
 
+#define _GNU_SOURCE  // mremap
+
+#include <execinfo.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "mem.h"
-// fitting policy
-enum POLICY policy;
 
 /**
  ** The BLOCK_HEADER structure serves as the header for each block.
@@ -30,11 +36,30 @@ enum POLICY policy;
  ** In this project we're going to use a struct that tracks additional
  ** information in the block header.
  **
- ** The first piece of information is a 'packed_pointer' that combines the
- ** absolute location (a memory address) of the next header and the alloc bit
- ** The headers must begin on an address divisible by 4. This means the last
- ** two bits must be 0.  We use the least significant bit (LSB) to indicate
- ** if the block is free: LSB = 0; or allocated LSB = 1.
+ ** The first piece of information is a 'packed_offset' that combines the
+ ** location of the next header and the flag bits.  The location is stored as
+ ** a 32 bit offset from the start of the arena the block belongs to (see
+ ** MEM_ARENA below) rather than an absolute address, so the header stays
+ ** 8 bytes on 64 bit machines and the arena can be mapped anywhere in the
+ ** address space.
+ ** The headers must begin on an address divisible by GRANULE (8). This means
+ ** the offset counts whole granules and its last three bits are always 0,
+ ** which is where the flags go.  We use the least significant bit (LSB) to
+ ** indicate if the block is free: LSB = 0; or allocated LSB = 1.
+ ** The second bit is the prev-free bit, set when the block physically before
+ ** this one is free.  The third bit is the slab bit, set on allocated blocks
+ ** whose payload is a slab of small objects (see Slab Allocator below).
+ **
+ ** The heap is shared between threads and protected by the arena lock.
+ ** Mem_Free looks at a header before taking the lock to check the pointer,
+ ** so the flag bits are always changed with atomic read-modify-writes, and
+ ** packed_offset is read atomically.  The size is changed the same way, as
+ ** Mem_Free sets REMOTE_BIT in it without the lock (see Remote Frees).
+ **
+ ** Free blocks also carry a footer: the last 4 bytes of their payload hold a
+ ** copy of the size.  With the prev-free bit and the footer the block above
+ ** can be found directly, so Mem_Free coalesces with both neighbours without
+ ** walking the list.  Allocated blocks have no footer and pay nothing extra.
  **
  ** The value stored in the size variable is either the size requested by
  ** the user for allocated blocks, or the available payload size (not including
@@ -43,21 +68,264 @@ enum POLICY policy;
  ** the requested_size / (padding + header_size).
  ** The provided function Mem_Dump takes care of this calculation for us.
  **
- ** The end of the list (the last header) has the packed_pointer  set to NULL,
- ** and the size set to 0.
+ ** The end of the list (the last header) has the offset set to 0 (offset 0
+ ** is the MEM_ARENA itself, never a header), and the size set to 0.
  */
 
 typedef struct BLOCK_HEADER {
-    void *packed_pointer;  // address of the next header + alloc bit.
+    unsigned packed_offset;  // offset of the next header from the arena + flag bits.
     unsigned size;
 } BLOCK_HEADER;
 
-BLOCK_HEADER *first_header;  // this global variable is a pointer to the first header
+#define GRANULE_LOG2 3
+#define GRANULE (1 << GRANULE_LOG2)
+#define ALLOC_BIT 1
+#define PREV_FREE_BIT 2
+#define SLAB_BIT 4
+#define FLAG_MASK (GRANULE - 1)
+#define REMOTE_BIT 0x80000000U  // in the size of a block queued for freeing, see Remote Frees
+
+/**
+ ** The header bitmap sits in front of the heap, outside of any block, and has
+ ** one bit per granule of the heap.  A bit is set exactly when a header
+ ** starts at that granule, so Mem_Free can tell a real block from any other
+ ** address without walking the list or taking the arena lock.  Mem_Alloc sets
+ ** the bit of the header it creates when splitting, coalescing clears the bit
+ ** of the header it absorbs.
+ */
+
+/**
+ ** The FREE_NODE structure indexes a free block by size.
+ **
+ ** It lives in the payload of the free block it describes, right after the
+ ** header, so the index costs no memory of its own.  Free blocks whose payload
+ ** is too small to hold a node are left out of the index; they are still on
+ ** the block list and get picked up again once a neighbour is freed and they
+ ** coalesce.
+ **
+ ** For BEST_FIT and WORST_FIT the nodes form an AVL tree ordered by
+ ** (size, address).  For TLSF the same nodes are chained into doubly linked
+ ** size class lists instead, 'left' being the previous and 'right' the next
+ ** node in the list.  FIRST_FIT and NEXT_FIT walk the block list by address
+ ** and do not need an index.
+ */
+typedef struct FREE_NODE {
+    unsigned left;   // offset of the left / previous node from the arena, 0 for none
+    unsigned right;  // offset of the right / next node from the arena, 0 for none
+    int height;
+} FREE_NODE;
+
+/**
+ ** TLSF (two-level segregated fit) size classes.
+ **
+ ** The first level splits sizes by powers of two, the second level splits
+ ** each power of two range into SL_INDEX_COUNT equal parts.  Sizes below
+ ** SMALL_BLOCK_SIZE all go to first level 0, in steps of GRANULE bytes.
+ ** A bit is set in fl_bitmap / sl_bitmap for every list that is non-empty,
+ ** so a fitting list is found with a couple of bit scans.
+ */
+#define SL_INDEX_COUNT_LOG2 4
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + GRANULE_LOG2)
+#define FL_INDEX_MAX 31
+#define FL_INDEX_COUNT (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define SMALL_BLOCK_SIZE (1 << FL_INDEX_SHIFT)
+
+/**
+ ** A LARGE_HEADER heads a block of at least mmap_threshold bytes, which gets
+ ** a mapping of its own instead of being carved out of the heap.  The header
+ ** starts the mapping and the user pointer sits 'offset' bytes after it:
+ ** right behind the header, or at the alignment asked for, which is at most
+ ** a page.  So the header is at the start of the page the user pointer is
+ ** in, or of the page before if the user pointer is page aligned, and
+ ** 'offset' has to match for a pointer to be taken as a large block.
+ **
+ ** The large blocks of an arena are kept on a doubly linked list so
+ ** Mem_Arena_Destroy can unmap them too.  The list has a lock of its own,
+ ** large_lock, taken after the arena lock when both are needed, so large
+ ** blocks are allocated and freed without waiting for the heap.
+ */
+typedef struct LARGE_HEADER {
+    struct LARGE_HEADER *prev;  // previous large block of the arena, NULL for the first
+    struct LARGE_HEADER *next;  // next large block of the arena, NULL for the last
+    MEM_ARENA *arena;           // arena the block belongs to, NULL once it is freed
+    unsigned size;              // size requested by the user
+    unsigned offset;            // bytes from the header to the user pointer
+} LARGE_HEADER;
+
+#define DEFAULT_MMAP_THRESHOLD (128 * 1024)
+
+/**
+ ** A SLAB holds objects of one small size class, from GRANULE up to
+ ** SLAB_MAX_SIZE bytes, packed back to back with no header of their own.
+ **
+ ** A slab is the payload of an ordinary allocated block with the slab bit
+ ** set, carved out of the heap SLAB_SIZE bytes long and SLAB_SIZE aligned.
+ ** The slab an object belongs to is found by masking the low bits off its
+ ** address, and the SLAB itself sits at the start of it, ahead of the
+ ** objects.  A bit in 'used' is set for every object handed out, and a bit
+ ** in 'cached' for every object that was freed into a thread cache and
+ ** still counts as used; the second bit is what catches a double free of a
+ ** cached object.
+ **
+ ** Slabs with room left are on a list per size class.  A slab that runs
+ ** empty goes back to the heap as a whole.  When the heap has no room for a
+ ** slab, small requests are served with ordinary blocks instead.
+ */
+#define SLAB_SIZE 4096
+#define SLAB_MAX_SIZE 64
+#define SLAB_CLASSES (SLAB_MAX_SIZE / GRANULE)
+#define SLAB_WORDS (SLAB_SIZE / GRANULE / 32)
+
+typedef struct SLAB {
+    unsigned prev;               // offset of the previous slab on the same list, 0 for none
+    unsigned next;               // offset of the next slab on the same list, 0 for none
+    unsigned size;               // object size
+    unsigned count;              // objects in use, cached ones included
+    unsigned used[SLAB_WORDS];    // objects handed out
+    unsigned cached[SLAB_WORDS];  // objects sitting in a thread cache
+} SLAB;
+
+#define SLAB_HEADER_SIZE ((sizeof(SLAB) + SLAB_MAX_SIZE - 1) / SLAB_MAX_SIZE * SLAB_MAX_SIZE)
+
+/**
+ ** A MEM_ARENA is one independent heap with its own mapping, fitting policy,
+ ** lock, free index and header bitmap.  Mem_Init sets up the default arena
+ ** behind Mem_Alloc and Mem_Free, Mem_Arena_Create makes as many more as
+ ** MAX_ARENAS allows.
+ **
+ ** Every arena reserves a window of ARENA_WINDOW bytes of address space,
+ ** aligned to ARENA_WINDOW, and maps only what it uses of it.  The MEM_ARENA
+ ** sits at the very start of the window, the header bitmap starts on the
+ ** next page and has room for a heap of HEAP_MAX bytes, and the heap comes
+ ** after that.  All offsets in headers and free nodes count from the
+ ** MEM_ARENA, and since the window is aligned the arena a block belongs to
+ ** is found by masking the low bits off its address.
+ **
+ ** The heap can grow up to max_size (by default the size it was created
+ ** with).  Growing maps more of the window right after the end of the heap,
+ ** so nothing moves: the end of heap header turns into the header of a free
+ ** block spanning the new memory and a new end of heap header is written at
+ ** the end of it.
+ **
+ ** An arena can also live in a file (see Heap Files below).  Then the whole
+ ** window maps the file MAP_SHARED, byte for byte, and growing the heap only
+ ** makes the file longer.  Nothing in the arena or the heap holds an
+ ** address, so a later process can map the file at any window and carry on.
+ */
+#define ARENA_WINDOW ((uintptr_t)1 << 32)
+#define HEAP_MAX ((unsigned)INT32_MAX + 1)
+#define MAX_ARENAS 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)  // default huge page size, also what THP uses
+#define MEM_MAP_ALL \
+    (MEM_MAP_ANONYMOUS | MEM_MAP_HUGETLB | MEM_MAP_THP | MEM_MAP_POPULATE | MEM_MAP_LOCK)
+#define QUICK_MAX_SIZE 1024  // largest block that is parked in deferred mode
+#define QUICK_CLASSES (QUICK_MAX_SIZE / GRANULE)
+#define FILE_MAGIC 0x46454d4c  // "LMEF", marks a heap file
+#define ARENA_SHARED (1 << 16)  // Arena_Create only: the file is shared memory, see Shared Memory
+
+struct MEM_ARENA {
+    unsigned magic;        // FILE_MAGIC once a heap file is set up, 0 for other arenas
+    unsigned layout;       // sizeof(MEM_ARENA) of the build that made the heap file
+    unsigned file;         // the arena lives in a file mapped MAP_SHARED
+    unsigned shared;       // the file is shared memory that several processes work on at once
+    unsigned dirty;        // a process has the heap file open
+    unsigned root;         // offset of the root object, 0 for none
+    enum POLICY policy;    // fitting policy
+    pthread_mutex_t lock;  // guards the block list and the index
+    unsigned serial;       // tells an arena from an earlier one mapped at the same address
+    unsigned bitmap;       // offset of the header bitmap
+    unsigned bitmap_size;  // bytes of the bitmap mapped so far
+    unsigned size;         // bytes of the heap, from the first header to the end of the heap header
+    unsigned max_size;     // bytes the heap may grow to
+    unsigned first;        // offset of the first header
+    unsigned last;         // offset of the end of heap header
+    unsigned rover;        // offset of the NEXT_FIT rover, the header the next search starts from
+    unsigned free_root;    // offset of the root of the size ordered tree of free blocks
+    unsigned fl_bitmap;    // non-empty first level classes
+    unsigned sl_bitmap[FL_INDEX_COUNT];  // non-empty lists per first level
+    unsigned free_lists[FL_INDEX_COUNT][SL_INDEX_COUNT];  // offsets of the size class list heads
+    int map_flags;            // MEM_MAP_* flags the heap is mapped with
+    unsigned map_unit;        // the heap is mapped and grown in multiples of this
+    unsigned mmap_threshold;  // requests from this many bytes on are mapped on their own, 0 for never
+    LARGE_HEADER *large;      // large blocks of the arena
+    pthread_mutex_t large_lock;  // guards the large blocks and their statistics
+    unsigned slab_partial[SLAB_CLASSES];  // offsets of the first slab with room left, per class
+    unsigned remote_free;  // offset of the last object pushed onto the remote free list, 0 for none
+    unsigned quick_limit;  // parked blocks that trigger coalescing, 0 when frees coalesce at once
+    unsigned quick_count;  // blocks parked on the quick lists
+    unsigned quick[QUICK_CLASSES];  // offsets of the last block parked per block size
+    unsigned handles;       // offset of the handle table, 0 until the first handle
+    unsigned handle_count;  // entries of the handle table, entry 0 included
+    unsigned handle_free;   // first unused handle, 0 for none
+
+    // Running statistics, kept up to date by the block operations, see Mem_Arena_Get_Stats
+    unsigned headers;                // headers of the heap, the end of heap header included
+    unsigned used_blocks;            // allocated blocks of the heap, slabs included
+    unsigned used_block_bytes;       // bytes from the allocated headers to the next header
+    unsigned used_bytes;             // bytes requested for the allocated blocks
+    unsigned free_blocks;            // free blocks of the heap
+    unsigned free_bytes;             // payload bytes of the free blocks
+    unsigned free_classes;           // power of two classes holding a free block
+    unsigned free_class_counts[32];  // free blocks whose payload has its top bit at i
+    unsigned slabs;                  // slabs carved from the heap
+    unsigned slab_objects;           // slab objects in use, cached ones included
+    unsigned slab_bytes;             // bytes of those objects
+    unsigned large_blocks;           // large blocks
+    size_t large_bytes;              // bytes requested for the large blocks
+    size_t large_headers;            // bytes from the large headers to the user pointers
+    size_t large_mapped;             // bytes mapped for the large blocks
+    unsigned long long alloc_count;    // successful allocations, updated atomically
+    unsigned long long free_count;     // successful frees, updated atomically
+    unsigned long long failed_allocs;  // allocations that returned NULL, updated atomically
+};
+
+MEM_ARENA *default_arena;  // the arena behind Mem_Alloc and Mem_Free
+int allocated_once;        // Mem_Init or Mem_Init_Flags has set up the default arena
+
+MEM_ARENA *arena_list[MAX_ARENAS];  // every live arena, NULL for unused entries
+int arena_files[MAX_ARENAS];         // file descriptor behind each arena of arena_list, if any
+unsigned arena_serial;               // serial of the last arena created
+pthread_mutex_t arena_list_lock = PTHREAD_MUTEX_INITIALIZER;  // guards arena_list and arena_serial
 
 // #################################################################################
 // ###############               Helper Functions               ####################
 // #################################################################################
 
+/**
+ * Returns the arena an address inside its window belongs to
+ *
+ * @param   p    a header, node or user pointer
+ * @return  the arena
+ */
+MEM_ARENA *Arena_Of(void *p) { return (MEM_ARENA *)((uintptr_t)p & ~(ARENA_WINDOW - 1)); }
+
+/**
+ * Turns an offset stored in the arena back into an address
+ *
+ * @param   arena   the arena the offset counts from
+ * @param   offset  offset from the arena, 0 for none
+ * @return  the address, NULL for none
+ */
+void *Arena_At(MEM_ARENA *arena, unsigned offset) {
+    return offset ? (unsigned char *)arena + offset : NULL;
+}
+
+/**
+ * Turns an address inside an arena into the offset stored in headers and nodes
+ *
+ * @param   arena   the arena p belongs to
+ * @param   p       an address inside the arena or NULL
+ * @return  offset from the arena, 0 for none
+ */
+unsigned Arena_Offset(MEM_ARENA *arena, void *p) {
+    return p ? (unsigned)((unsigned char *)p - (unsigned char *)arena) : 0;
+}
+
+BLOCK_HEADER *First_Header(MEM_ARENA *arena) { return Arena_At(arena, arena->first); }
+
+BLOCK_HEADER *Last_Header(MEM_ARENA *arena) { return Arena_At(arena, arena->last); }
+
 /**
  * Checks if the header is allocated
  * 
@@ -65,19 +333,18 @@ BLOCK_HEADER *first_header;  // this global variable is a pointer to the first h
  * @return      1 if allocated, 0 if not
  */
 int Is_Allocated(BLOCK_HEADER *p) {
-    return (unsigned)p->packed_pointer % 2;
+    return __atomic_load_n(&p->packed_offset, __ATOMIC_RELAXED) & ALLOC_BIT;
 }
 
 /**
  * Sets the allocated bit to 1
+ *
+ * Atomic, Mem_Free may be reading the header without the lock.
  * 
  * @param   p    pointer to a block header
  */
 void Set_Allocated(BLOCK_HEADER *p) {
-    if (!Is_Allocated(p))
-        p->packed_pointer = (unsigned char *)p->packed_pointer + 1;
-    // else
-    // printf("Trying to allocate what is already allocated!!!\n\n");
+    __atomic_fetch_or(&p->packed_offset, ALLOC_BIT, __ATOMIC_RELAXED);
 }
 
 /**
@@ -94,10 +361,7 @@ int Is_Free(BLOCK_HEADER *p) { return !Is_Allocated(p); }
  * @param   p    pointer to a block header
  */
 void Set_Free(BLOCK_HEADER *p) {
-    if (Is_Allocated(p))
-        p->packed_pointer = (unsigned char *)p->packed_pointer - 1;
-    // else
-    // printf("Trying to free what is already free!!!\n\n");
+    __atomic_fetch_and(&p->packed_offset, ~ALLOC_BIT, __ATOMIC_RELAXED);
 }
 
 /**
@@ -106,7 +370,68 @@ void Set_Free(BLOCK_HEADER *p) {
  * @param   cur Current header
  * @return  pointer to the next header, NULL if current is last
  */
-BLOCK_HEADER *Get_Next_Header(BLOCK_HEADER *cur) { return (BLOCK_HEADER *)cur->packed_pointer; }
+BLOCK_HEADER *Get_Next_Header(BLOCK_HEADER *cur) {
+    unsigned offset = __atomic_load_n(&cur->packed_offset, __ATOMIC_RELAXED) & ~FLAG_MASK;
+    return Arena_At(Arena_Of(cur), offset);
+}
+
+/**
+ * Checks if the block physically before this one is free
+ *
+ * @param   p    pointer to a block header
+ * @return      1 if the previous block is free, 0 if not
+ */
+int Is_Prev_Free(BLOCK_HEADER *p) {
+    return (__atomic_load_n(&p->packed_offset, __ATOMIC_RELAXED) & PREV_FREE_BIT) != 0;
+}
+
+/**
+ * Sets the prev-free bit to 1
+ *
+ * Atomic, Mem_Free may be reading the header without the lock.
+ *
+ * @param   p    pointer to a block header
+ */
+void Set_Prev_Free(BLOCK_HEADER *p) {
+    __atomic_fetch_or(&p->packed_offset, PREV_FREE_BIT, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sets the prev-free bit to 0
+ *
+ * @param   p    pointer to a block header
+ */
+void Clear_Prev_Free(BLOCK_HEADER *p) {
+    __atomic_fetch_and(&p->packed_offset, ~PREV_FREE_BIT, __ATOMIC_RELAXED);
+}
+
+/**
+ * Checks if the payload of an allocated block is a slab
+ *
+ * @param   p    pointer to a block header
+ * @return      1 if a slab, 0 if not
+ */
+int Is_Slab(BLOCK_HEADER *p) {
+    return (__atomic_load_n(&p->packed_offset, __ATOMIC_RELAXED) & SLAB_BIT) != 0;
+}
+
+/**
+ * Sets the slab bit to 1
+ *
+ * @param   p    pointer to a block header
+ */
+void Set_Slab(BLOCK_HEADER *p) {
+    __atomic_fetch_or(&p->packed_offset, SLAB_BIT, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sets the slab bit to 0
+ *
+ * @param   p    pointer to a block header
+ */
+void Clear_Slab(BLOCK_HEADER *p) {
+    __atomic_fetch_and(&p->packed_offset, ~SLAB_BIT, __ATOMIC_RELAXED);
+}
 
 /**
  * Returns size of payload only
@@ -114,7 +439,7 @@ BLOCK_HEADER *Get_Next_Header(BLOCK_HEADER *cur) { return (BLOCK_HEADER *)cur->p
  * @param   p    pointer to a block header
  * @return  size of the block
  */
-int Get_Size(BLOCK_HEADER *p) { return p->size; }
+int Get_Size(BLOCK_HEADER *p) { return p->size & ~REMOTE_BIT; }
 
 /**
  * Returns an address that user can use, given a head address
@@ -133,405 +458,4063 @@ void *Get_User_Pointer(BLOCK_HEADER *cur) { return (unsigned char *)cur + sizeof
 void *Get_Header_From_User_Pointer(void *cur) { return (unsigned char *)cur - sizeof(BLOCK_HEADER); }
 
 /**
- * Sets the next pointer of a block
+ * Returns the space between the header and the next header, i.e. payload plus padding
+ *
+ * @param   p    pointer to a block header
+ * @return  size of the block without its header
+ */
+int Get_Block_Size(BLOCK_HEADER *p) {
+    return (unsigned char *)Get_Next_Header(p) - (unsigned char *)Get_User_Pointer(p);
+}
+
+/**
+ * Sets the next pointer of a block, the flag bits are kept
+ *
+ * A compare and swap, so a flag set by an atomic operation meanwhile is not lost.
  * 
  * @param   cur Current header
  */
 void Set_Next_Pointer(BLOCK_HEADER *cur, BLOCK_HEADER *dst) {
-    cur->packed_pointer = dst;
+    unsigned offset = Arena_Offset(Arena_Of(cur), dst);
+    unsigned old = __atomic_load_n(&cur->packed_offset, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&cur->packed_offset, &old, offset | (old & FLAG_MASK), 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/**
+ * Copies the size of a free block into its footer, the last 4 bytes of the payload
+ *
+ * @param   p    pointer to a free block header
+ */
+void Set_Footer(BLOCK_HEADER *p) { ((unsigned *)Get_Next_Header(p))[-1] = p->size; }
+
+/**
+ * Finds the block physically before this one through its footer
+ *
+ * Only valid when the prev-free bit is set, allocated blocks have no footer.
+ *
+ * @param   p    pointer to a block header
+ * @return  header of the free block above
+ */
+BLOCK_HEADER *Get_Prev_Header(BLOCK_HEADER *p) {
+    unsigned prev_size = ((unsigned *)p)[-1];
+    return (BLOCK_HEADER *)((unsigned char *)p - prev_size - sizeof(BLOCK_HEADER));
+}
+
+/**
+ * Starts a header over where there was payload: no next header, no flags, size 0
+ *
+ * @param   p    where the new header goes
+ */
+void Init_Header(BLOCK_HEADER *p) {
+    __atomic_store_n(&p->packed_offset, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&p->size, 0, __ATOMIC_RELAXED);
 }
 
 /**
- * Sets the size of the block
+ * Sets the size of the block, REMOTE_BIT is kept
+ *
+ * A compare and swap, Mem_Free may be setting REMOTE_BIT without the lock.
  * 
  * @param   p       pointer to a block header
  * @param   size    size of the usable memory
  */
-void Set_Size(BLOCK_HEADER *p, int size) { p->size = size; }
+void Set_Size(BLOCK_HEADER *p, int size) {
+    unsigned old = __atomic_load_n(&p->size, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&p->size, &old, size | (old & REMOTE_BIT), 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
 
 /**
- * @brief Gives int padding if not divisiable by 4
+ * @brief Gives int padding if not divisiable by GRANULE (8)
  * 
  * @param x     requested size
- * @return      Size padded to nearest 4 
+ * @return      Size padded to nearest GRANULE 
  */
 int Pad_Size(int x) {
     int mod;
 
-    // Calculates how much til the next 4
+    // Calculates how much til the next granule
     // Adds what's needed
-    if ((mod = x % 4)) x += (4 - mod);
+    if ((mod = x % GRANULE)) x += (GRANULE - mod);
     return x;
 }
 
 /**
- * @brief Finds the next available block
- * 
- * @return void* pointer to the next free block
- */
-void *Get_Next_Free(int size) {
-    // printf("Need size of: %i", size);
-    // printf("\n\n########### Begin Traversal ###########\n");
-    BLOCK_HEADER *curr = first_header;
-    // printf("HEAD\ncur at: %p\t size: %i\t next: %p\n\n", curr, curr->size, curr->packed_pointer);
-
-    int i = 0;
-    // Searches through all of the blocks
-    while (curr->packed_pointer != NULL) {
-        // If block already allocated
-        if (Is_Allocated(curr)) {
-            // printf("Is allocated\n");
-
-            // Saves a refrence to
-            BLOCK_HEADER *temp = curr;
-
-            // Sets the last bit to 0
-            Set_Free(curr);
-            // printf("%i: cur at: %p\t size: %i\t next: %p\n", i, curr, curr->size, curr->packed_pointer);
-
-            // Traverses to the free address
-            curr = Get_Next_Header(curr);
-
-            // Make the original back to allocated
-            Set_Allocated(temp);
-            // printf("new: %p\n\n", curr);
-        }
+ * @brief Rounds up to whole pages
+ *
+ * @param x     size in bytes
+ * @return      size padded to the next multiple of the page size
+ */
+unsigned Pad_Page(unsigned x) {
+    unsigned pagesize = getpagesize();
+    return x + (pagesize - x % pagesize) % pagesize;
+}
 
-        // If block doesn't have enough size
-        else if (Get_Size(curr) < size) {
-            // printf("Not big enough\n");
-            // printf("%i, cur at: %p\t size: %i\t next: %p\n", i, curr, curr->size, curr->packed_pointer);
-            curr = Get_Next_Header(curr);
-        }
+/**
+ * @brief Rounds up to a multiple of a mapping unit
+ *
+ * @param x     size in bytes
+ * @param unit  page or huge page size
+ * @return      size padded to the next multiple of unit
+ */
+unsigned Pad_Unit(unsigned x, unsigned unit) { return x + (unit - x % unit) % unit; }
 
-        // Perfect block
-        else {
-            // printf("%i: Found it: %p\n", i, curr);
-            return curr;
-        }
-        i++;
-    }
+// #################################################################################
+// ###############                Header Bitmap                 ####################
+// #################################################################################
 
-    // printf("Can't find free space, something wrong\n");
-    return NULL;
+/**
+ * Returns which granule of its heap an address falls in
+ *
+ * @param   p    an address inside the heap
+ * @return  index of the granule
+ */
+unsigned Granule_Index(void *p) {
+    return ((unsigned char *)p - (unsigned char *)First_Header(Arena_Of(p))) / GRANULE;
 }
 
 /**
- * @brief Gets a unmodified version of the next pointer
- * 
- * @param cur   a pointer to a block header
- * @return      unmodified version of pointer
- */
-void *Get_Free(BLOCK_HEADER *cur) {
-    // printf("GET FREE POINTER: Before -> %p\n", cur->packed_pointer);
-    if (Is_Allocated(cur)) {
-        // printf("After: %p\n", (unsigned char *)cur->packed_pointer - 1);
-        return (unsigned char *)cur->packed_pointer - 1;
-    } else {
-        // printf("After: %p\n", cur->packed_pointer);
-        return cur->packed_pointer;
-    }
+ * Returns the header bitmap of the arena p belongs to
+ */
+unsigned *Header_Bitmap(void *p) {
+    MEM_ARENA *arena = Arena_Of(p);
+    return Arena_At(arena, arena->bitmap);
 }
 
 /**
- * @brief 
- * 
- * @param ptr 
- * @return int 
+ * Records that a header starts at p
+ *
+ * @param   p    pointer to a block header
  */
-int Valid_Block(void *ptr) {
-    BLOCK_HEADER *cur = first_header;
-    int valid = 0;
-    while (cur->packed_pointer != NULL) {
-        if (ptr == cur) valid = 1;
-        cur = Get_Free(cur);
-        // printf("%p\n", cur);
-    }
-    return valid;
+void Mark_Header(BLOCK_HEADER *p) {
+    unsigned i = Granule_Index(p);
+    __atomic_fetch_or(&Header_Bitmap(p)[i / 32], 1U << (i % 32), __ATOMIC_RELAXED);
+    Arena_Of(p)->headers++;
+}
+
+/**
+ * Records that no header starts at p anymore
+ *
+ * @param   p    pointer to a block header that was absorbed
+ */
+void Unmark_Header(BLOCK_HEADER *p) {
+    unsigned i = Granule_Index(p);
+    __atomic_fetch_and(&Header_Bitmap(p)[i / 32], ~(1U << (i % 32)), __ATOMIC_RELAXED);
+    Arena_Of(p)->headers--;
+}
+
+/**
+ * Checks if a header starts at p
+ *
+ * @param   p    an address inside the heap, divisible by GRANULE
+ * @return  1 if a header starts at p, 0 if not
+ */
+int Is_Header(void *p) {
+    unsigned i = Granule_Index(p);
+    return (__atomic_load_n(&Header_Bitmap(p)[i / 32], __ATOMIC_RELAXED) >> (i % 32)) & 1;
 }
 
 // #################################################################################
-// ###############               Init Function                  ####################
+// ###############                  Statistics                  ####################
 // #################################################################################
 
 /**
- **  Function used to Initialize the memory allocator.
- *!  Do not change this function.
- *  Written by Cherin Joseph, Modified by Michael Doescher.
- *
- *!  Not intended to be called more than once by a program.
- *
- *?  Notes we're using mmap here instead of sbrk as in the book to take advantage of caching
- *?  as described in the OS lectures.
+ * @brief Counts an allocated block of the heap in or out of the statistics
  *
- *  Study the end of the function where the headers are initialized for hints!
+ * The caller holds the arena lock.  A block is counted in once its size is
+ * final and out before its size changes or it is freed.
  *
- *  @param sizeOfRegion:  Specifies the size of the chunk which needs to be allocated
- *  @param policy_input:  indicates the policy to use eg: best fit is 0
- *  @return            :  0 on success, -1 on failure
+ * @param   p       pointer to an allocated block header
+ * @param   sign    1 to count the block in, -1 to count it out
  */
-int Mem_Init(int sizeOfRegion, enum POLICY policy_input) {
-    policy = policy_input;
-
-    int pagesize;
-    int padsize;
-    int fd;
-    int alloc_size;
-    void *space_ptr;
-    static int allocated_once = 0;
-
-    if (0 != allocated_once) {
-        fprintf(stderr, "Error:mem.c: Mem_Init has allocated space during a previous call\n");
-        return -1;
-    }
-    if (sizeOfRegion <= 0) {
-        fprintf(stderr, "Error:mem.c: Requested block size is not positive\n");
-        return -1;
-    }
-
-    /* Calculate padsize as the padding required to round up sizeOfRegion to a multiple of pagesize
-     */
-    pagesize = getpagesize();  //  Get the pagesize
-    padsize = sizeOfRegion % pagesize;
-    padsize = (pagesize - padsize) % pagesize;
-    alloc_size = sizeOfRegion + padsize;
+void Stats_Used(BLOCK_HEADER *p, int sign) {
+    MEM_ARENA *arena = Arena_Of(p);
 
-    printf("requested size: %i\tallocated sise: %i\n", sizeOfRegion, alloc_size);
+    arena->used_blocks += sign;
+    arena->used_block_bytes += sign * Get_Block_Size(p);
+    arena->used_bytes += sign * Get_Size(p);
+}
 
-    /* Using mmap to allocate memory */
-    fd = open("/dev/zero", O_RDWR);
-    if (-1 == fd) {
-        fprintf(stderr, "Error:mem.c: Cannot open /dev/zero\n");
-        return -1;
-    }
-    space_ptr = mmap(NULL, alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
-    if (MAP_FAILED == space_ptr) {
-        fprintf(stderr, "Error:mem.c: mmap cannot allocate space\n");
-        allocated_once = 0;
-        return -1;
-    }
+/**
+ * @brief Counts a free block of the heap in or out of the statistics
+ *
+ * Called from Index_Insert and Index_Remove, which every policy goes
+ * through, so the free blocks are counted whether the policy indexes them
+ * or not.
+ *
+ * @param   p       pointer to a free block header
+ * @param   sign    1 to count the block in, -1 to count it out
+ */
+void Stats_Free(BLOCK_HEADER *p, int sign) {
+    MEM_ARENA *arena = Arena_Of(p);
+    int cls = 31 - __builtin_clz(Get_Size(p) | 1);
 
-    allocated_once = 1;
+    arena->free_blocks += sign;
+    arena->free_bytes += sign * Get_Size(p);
+    arena->free_class_counts[cls] += sign;
+    if (arena->free_class_counts[cls] != 0)
+        arena->free_classes |= 1U << cls;
+    else
+        arena->free_classes &= ~(1U << cls);
+}
 
-    // To begin with, there is only one big, free block.
-    // Initialize the first header */
-    first_header = (BLOCK_HEADER *)space_ptr;
-    // free size
-    // Remember that the 'size' stored for free blocks excludes the space for the headers
-    first_header->size = (unsigned)alloc_size - 2 * sizeof(BLOCK_HEADER);
-    // address of last header
-    first_header->packed_pointer = (void *)first_header + alloc_size - sizeof(BLOCK_HEADER);
+/**
+ * Adds to a counter that is updated without the arena lock
+ */
+void Stats_Count(unsigned long long *counter, unsigned n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
 
-    // initialize last header
-    // packed_pointers are void pointer, the headers are not
-    BLOCK_HEADER *last_header = (BLOCK_HEADER *)first_header->packed_pointer;
-    last_header->size = 0;
-    last_header->packed_pointer = NULL;
-    return 0;
+/**
+ * @brief Counts the outcome of an allocation, returns its result
+ *
+ * @param   ptr     what the allocation returned
+ */
+void *Stats_Alloc(MEM_ARENA *arena, void *ptr) {
+    Stats_Count(ptr != NULL ? &arena->alloc_count : &arena->failed_allocs, 1);
+    return ptr;
 }
 
 // #################################################################################
-// ###############              Allocate Memory                 ####################
+// ###############               Free Block Index               ####################
 // #################################################################################
 
 /**
- ** Function for allocating 'size' bytes.
- *
- *     Check for sanity of size - Return NULL when appropriate - at least 1 byte. 
- *     Traverse the list of blocks and locate a free block which can accommodate
- *              the requested size based on the policy (e.g. first fit, best fit). 
- * TODO:    The next header must be aligned with an address divisible by 4. 
- *              Add padding to accomodate this requirement. 
- * TODO:    When allocating a block - split it into two blocks when possible. 
- *          ? the allocated block should go first and the free block second. 
- *          ? the free block must have a minimum payload size of 4 bytes.  
- *          ? do not split if the mininmum payload size can not be reserved. 
+ * Returns the header of the free block a node lives in
  * 
- * @param   size    How much free space needed
- * @return  :   the user writeable address of allocated block 
- *                  ! this is the first byte of the payload, not the address of the header
- *              NULL on failure
+ * @param   node    a free node
+ * @return  header of the block
  */
-void *Mem_Alloc(int size) {
-    // Checks size is 1 or larger
-    if (size < 1) return NULL;
+BLOCK_HEADER *Node_Header(FREE_NODE *node) { return Get_Header_From_User_Pointer(node); }
 
-    BLOCK_HEADER *free;
+/**
+ * Turns an offset stored in a node back into a node
+ *
+ * @param   arena   the arena the offset counts from
+ * @param   offset  offset from the arena, 0 for none
+ * @return  the node, NULL for none
+ */
+FREE_NODE *Node_At(MEM_ARENA *arena, unsigned offset) { return Arena_At(arena, offset); }
 
-    // printf("Head at: %p\n", first_header);
+/**
+ * Turns a node into the offset stored in other nodes
+ *
+ * @param   node    a free node or NULL
+ * @return  offset from the arena, 0 for none
+ */
+unsigned Node_Offset(FREE_NODE *node) { return Arena_Offset(Arena_Of(node), node); }
 
-    // Gets size with padding to %4
-    int resize = Pad_Size(size);
+FREE_NODE *Get_Left(FREE_NODE *node) { return Node_At(Arena_Of(node), node->left); }
 
-    // Find a suitable block
-    if ((free = Get_Next_Free(size)) == NULL) {
-        return NULL;
-    }
+FREE_NODE *Get_Right(FREE_NODE *node) { return Node_At(Arena_Of(node), node->right); }
 
-    // printf("Free block at: %p\tSize is: %i\tPoints to: %p\n\n", free, free->size, free->packed_pointer);
+void Set_Left(FREE_NODE *node, FREE_NODE *left) { node->left = Node_Offset(left); }
 
-    // printf("Padded size: %i\tSplit size: %i\n", resize, free->size - sizeof(BLOCK_HEADER) - resize);
+void Set_Right(FREE_NODE *node, FREE_NODE *right) { node->right = Node_Offset(right); }
 
-    // If there is only size of header left, no split
-    if ((int)(free->size - sizeof(BLOCK_HEADER) - resize) < 4) {
-        // printf("\nNo need to split\n\n");
+/**
+ * Orders two nodes by block size, ties are broken by address
+ *
+ * @return  negative if a goes before b, positive if after, 0 if same node
+ */
+int Node_Compare(FREE_NODE *a, FREE_NODE *b) {
+    unsigned a_size = Node_Header(a)->size;
+    unsigned b_size = Node_Header(b)->size;
 
-        Set_Allocated(free);
-        Set_Size(free, size);
-        // printf("block at: %p\tSize is: %i\tPoints to: %p\n\n", free, free->size, free->packed_pointer);
+    if (a_size != b_size) return a_size < b_size ? -1 : 1;
+    if (a != b) return a < b ? -1 : 1;
+    return 0;
+}
+
+/**
+ * Height of a subtree, 0 for an empty one
+ */
+int Node_Height(FREE_NODE *node) { return node ? node->height : 0; }
+
+/**
+ * Recomputes the height of a node from its children
+ */
+void Node_Update(FREE_NODE *node) {
+    int l = Node_Height(Get_Left(node));
+    int r = Node_Height(Get_Right(node));
+    node->height = (l > r ? l : r) + 1;
+}
+
+FREE_NODE *Rotate_Right(FREE_NODE *node) {
+    FREE_NODE *top = Get_Left(node);
+    Set_Left(node, Get_Right(top));
+    Set_Right(top, node);
+    Node_Update(node);
+    Node_Update(top);
+    return top;
+}
+
+FREE_NODE *Rotate_Left(FREE_NODE *node) {
+    FREE_NODE *top = Get_Right(node);
+    Set_Right(node, Get_Left(top));
+    Set_Left(top, node);
+    Node_Update(node);
+    Node_Update(top);
+    return top;
+}
+
+/**
+ * @brief Restores the AVL property at a node whose subtrees differ in height by at most 2
+ *
+ * @param node  root of the subtree
+ * @return      new root of the subtree
+ */
+FREE_NODE *Tree_Balance(FREE_NODE *node) {
+    Node_Update(node);
+    FREE_NODE *left = Get_Left(node);
+    FREE_NODE *right = Get_Right(node);
+    int balance = Node_Height(left) - Node_Height(right);
+
+    if (balance > 1) {
+        if (Node_Height(Get_Left(left)) < Node_Height(Get_Right(left)))
+            Set_Left(node, Rotate_Left(left));
+        return Rotate_Right(node);
+    }
+    if (balance < -1) {
+        if (Node_Height(Get_Right(right)) < Node_Height(Get_Left(right)))
+            Set_Right(node, Rotate_Right(right));
+        return Rotate_Left(node);
+    }
+    return node;
+}
+
+/**
+ * @brief Inserts a node into a subtree
+ *
+ * @return  new root of the subtree
+ */
+FREE_NODE *Tree_Insert(FREE_NODE *root, FREE_NODE *node) {
+    if (root == NULL) {
+        node->left = 0;
+        node->right = 0;
+        node->height = 1;
+        return node;
+    }
+
+    if (Node_Compare(node, root) < 0)
+        Set_Left(root, Tree_Insert(Get_Left(root), node));
+    else
+        Set_Right(root, Tree_Insert(Get_Right(root), node));
+    return Tree_Balance(root);
+}
+
+/**
+ * @brief Unlinks the smallest node of a subtree
+ *
+ * @param min   set to the node that was unlinked
+ * @return      new root of the subtree
+ */
+FREE_NODE *Tree_Remove_Min(FREE_NODE *root, FREE_NODE **min) {
+    if (root->left == 0) {
+        *min = root;
+        return Get_Right(root);
+    }
+    Set_Left(root, Tree_Remove_Min(Get_Left(root), min));
+    return Tree_Balance(root);
+}
+
+/**
+ * @brief Unlinks a node from a subtree
+ *
+ * The size of the block must not have changed since it was inserted.
+ *
+ * @return  new root of the subtree
+ */
+FREE_NODE *Tree_Remove(FREE_NODE *root, FREE_NODE *node) {
+    if (root == NULL) return NULL;
+
+    int cmp = Node_Compare(node, root);
+    if (cmp < 0) {
+        Set_Left(root, Tree_Remove(Get_Left(root), node));
+    } else if (cmp > 0) {
+        Set_Right(root, Tree_Remove(Get_Right(root), node));
+    } else {
+        if (root->left == 0) return Get_Right(root);
+        if (root->right == 0) return Get_Left(root);
+
+        // Replace the node with its in-order successor
+        FREE_NODE *succ;
+        FREE_NODE *right = Tree_Remove_Min(Get_Right(root), &succ);
+        succ->left = root->left;
+        Set_Right(succ, right);
+        root = succ;
+    }
+    return Tree_Balance(root);
+}
+
+// #################################################################################
+// ###############                  TLSF Engine                 ####################
+// #################################################################################
+
+/**
+ * @brief Finds the size class list a free block of 'size' bytes belongs in
+ *
+ * @param size  payload size of the block
+ * @param fli   set to the first level index
+ * @param sli   set to the second level index
+ */
+void Tlsf_Mapping_Insert(unsigned size, int *fli, int *sli) {
+    if (size < SMALL_BLOCK_SIZE) {
+        *fli = 0;
+        *sli = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+    } else {
+        int fl = 31 - __builtin_clz(size);
+        *sli = (size >> (fl - SL_INDEX_COUNT_LOG2)) ^ (1 << SL_INDEX_COUNT_LOG2);
+        *fli = fl - (FL_INDEX_SHIFT - 1);
+    }
+}
+
+/**
+ * @brief Finds the first size class in which every block holds at least 'size' bytes
+ *
+ * The size is rounded up to the next class boundary, so whatever is found in
+ * that class fits without having to look at the block.
+ */
+void Tlsf_Mapping_Search(unsigned size, int *fli, int *sli) {
+    if (size >= SMALL_BLOCK_SIZE)
+        size += (1U << (31 - __builtin_clz(size) - SL_INDEX_COUNT_LOG2)) - 1;
+    Tlsf_Mapping_Insert(size, fli, sli);
+}
+
+/**
+ * @brief Pushes a free block on the front of its size class list
+ *
+ * @param p     free block header
+ */
+void Tlsf_Insert(BLOCK_HEADER *p) {
+    int fl, sl;
+    MEM_ARENA *arena = Arena_Of(p);
+    FREE_NODE *node = Get_User_Pointer(p);
+    FREE_NODE *head;
+
+    Tlsf_Mapping_Insert(Get_Size(p), &fl, &sl);
+    head = Node_At(arena, arena->free_lists[fl][sl]);
+    node->left = 0;
+    Set_Right(node, head);
+    if (head != NULL) Set_Left(head, node);
+    arena->free_lists[fl][sl] = Node_Offset(node);
+
+    arena->fl_bitmap |= 1U << fl;
+    arena->sl_bitmap[fl] |= 1U << sl;
+}
+
+/**
+ * @brief Unlinks a free block from its size class list
+ *
+ * @param p     free block header
+ */
+void Tlsf_Remove(BLOCK_HEADER *p) {
+    int fl, sl;
+    MEM_ARENA *arena = Arena_Of(p);
+    FREE_NODE *node = Get_User_Pointer(p);
+
+    Tlsf_Mapping_Insert(Get_Size(p), &fl, &sl);
+    if (node->left != 0)
+        Get_Left(node)->right = node->right;
+    else
+        arena->free_lists[fl][sl] = node->right;
+    if (node->right != 0) Get_Right(node)->left = node->left;
+
+    // Clear the bits once the list runs empty
+    if (arena->free_lists[fl][sl] == 0) {
+        arena->sl_bitmap[fl] &= ~(1U << sl);
+        if (arena->sl_bitmap[fl] == 0) arena->fl_bitmap &= ~(1U << fl);
+    }
+}
+
+/**
+ * @brief Finds a free block of at least 'size' bytes in constant time
+ *
+ * @return  header of the block, NULL if no class holds one
+ */
+BLOCK_HEADER *Tlsf_Find(MEM_ARENA *arena, int size) {
+    int fl, sl;
+    unsigned map;
+
+    Tlsf_Mapping_Search(size, &fl, &sl);
+    if (fl >= FL_INDEX_COUNT) return NULL;
+
+    // Any list left in this first level class at or above sl will do
+    map = arena->sl_bitmap[fl] & (~0U << sl);
+    if (map == 0) {
+        // Otherwise take the smallest non-empty first level class above
+        map = arena->fl_bitmap & (~0U << (fl + 1));
+        if (map == 0) return NULL;
+        fl = __builtin_ctz(map);
+        map = arena->sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(map);
+    return Node_Header(Node_At(arena, arena->free_lists[fl][sl]));
+}
+
+// #################################################################################
+// ###############               Index Dispatch                 ####################
+// #################################################################################
+
+/**
+ * Checks if the policy of an arena keeps free blocks in the size index
+ */
+int Uses_Index(MEM_ARENA *arena) {
+    return arena->policy == BEST_FIT || arena->policy == WORST_FIT || arena->policy == TLSF;
+}
+
+/**
+ * Checks if a free block is big enough to carry a FREE_NODE next to its footer
+ */
+int Is_Indexable(BLOCK_HEADER *p) {
+    return Get_Size(p) >= (int)(sizeof(FREE_NODE) + sizeof(unsigned));
+}
+
+/**
+ * @brief Adds a free block to the index, call after its size is final
+ *
+ * @param p     free block header
+ */
+void Index_Insert(BLOCK_HEADER *p) {
+    MEM_ARENA *arena = Arena_Of(p);
+
+    Stats_Free(p, 1);
+    if (!Uses_Index(arena) || !Is_Indexable(p)) return;
+
+    if (arena->policy == TLSF)
+        Tlsf_Insert(p);
+    else
+        arena->free_root =
+            Node_Offset(Tree_Insert(Node_At(arena, arena->free_root), Get_User_Pointer(p)));
+}
+
+/**
+ * @brief Removes a free block from the index, call before its size changes
+ *
+ * @param p     free block header
+ */
+void Index_Remove(BLOCK_HEADER *p) {
+    MEM_ARENA *arena = Arena_Of(p);
+
+    Stats_Free(p, -1);
+    if (!Uses_Index(arena) || !Is_Indexable(p)) return;
+
+    if (arena->policy == TLSF)
+        Tlsf_Remove(p);
+    else
+        arena->free_root =
+            Node_Offset(Tree_Remove(Node_At(arena, arena->free_root), Get_User_Pointer(p)));
+}
+
+/**
+ * @brief Smallest indexed free block with at least 'size' bytes of payload
+ *
+ * @return  header of the block, NULL if none fits
+ */
+BLOCK_HEADER *Index_Best(MEM_ARENA *arena, int size) {
+    FREE_NODE *cur = Node_At(arena, arena->free_root);
+    FREE_NODE *best = NULL;
+
+    while (cur != NULL) {
+        if (Get_Size(Node_Header(cur)) >= size) {
+            best = cur;
+            cur = Get_Left(cur);
+        } else {
+            cur = Get_Right(cur);
+        }
+    }
+    return best ? Node_Header(best) : NULL;
+}
+
+/**
+ * @brief Largest indexed free block, if it has at least 'size' bytes of payload
+ *
+ * @return  header of the block, NULL if none fits
+ */
+BLOCK_HEADER *Index_Worst(MEM_ARENA *arena, int size) {
+    FREE_NODE *cur = Node_At(arena, arena->free_root);
+
+    if (cur == NULL) return NULL;
+    while (cur->right != 0) cur = Get_Right(cur);
+    return Get_Size(Node_Header(cur)) >= size ? Node_Header(cur) : NULL;
+}
+
+/**
+ * @brief Payload of the largest free block, the caller holds the arena lock
+ *
+ * BEST_FIT and WORST_FIT take the rightmost node of the tree, TLSF the
+ * biggest block on its highest non-empty list.  FIRST_FIT and NEXT_FIT
+ * keep no index and walk the block list, and so does every policy when the
+ * only free blocks are too small to be indexed.  Statistics are not on the
+ * allocation path, the walk is cheap enough there.
+ *
+ * @return  the payload, 0 if nothing is free
+ */
+unsigned Index_Largest(MEM_ARENA *arena) {
+    unsigned largest = 0;
+    BLOCK_HEADER *block = NULL;
+    FREE_NODE *node;
+    int fl;
+    int sl;
+
+    if (arena->policy == BEST_FIT || arena->policy == WORST_FIT) {
+        block = Index_Worst(arena, 0);
+    } else if (arena->policy == TLSF && arena->fl_bitmap != 0) {
+        fl = 31 - __builtin_clz(arena->fl_bitmap);
+        sl = 31 - __builtin_clz(arena->sl_bitmap[fl]);
+        for (node = Node_At(arena, arena->free_lists[fl][sl]); node != NULL; node = Get_Right(node))
+            if (block == NULL || Get_Size(Node_Header(node)) > Get_Size(block))
+                block = Node_Header(node);
+    }
+    if (block != NULL) return Get_Size(block);
+    if (arena->free_blocks == 0) return 0;
+
+    for (block = First_Header(arena); Get_Next_Header(block) != NULL;
+         block = Get_Next_Header(block))
+        if (Is_Free(block) && Get_Size(block) > largest) largest = Get_Size(block);
+    return largest;
+}
+
+/**
+ * @brief Walks the block list from start up to (not including) stop for a free block
+ *
+ * @param start first header to look at
+ * @param stop  header to stop at, NULL to run to the end of the list
+ * @return      first free block with at least 'size' bytes of payload, NULL if none
+ */
+BLOCK_HEADER *Walk_Free(BLOCK_HEADER *start, BLOCK_HEADER *stop, int size) {
+    BLOCK_HEADER *curr = start;
+
+    while (curr != stop && Get_Next_Header(curr) != NULL) {
+        if (Is_Free(curr) && Get_Size(curr) >= size) return curr;
+        curr = Get_Next_Header(curr);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the next available block according to the fitting policy of the arena
+ *
+ * @param size  padded payload size needed
+ * @return      header of a free block big enough, NULL if there is none
+ */
+void *Get_Next_Free(MEM_ARENA *arena, int size) {
+    BLOCK_HEADER *found;
+    BLOCK_HEADER *rover;
+
+    switch (arena->policy) {
+        case BEST_FIT:
+            return Index_Best(arena, size);
+        case WORST_FIT:
+            return Index_Worst(arena, size);
+        case TLSF:
+            return Tlsf_Find(arena, size);
+        case NEXT_FIT:
+            // Resume from the rover and wrap around to the start of the list once
+            rover = Arena_At(arena, arena->rover);
+            if ((found = Walk_Free(rover, NULL, size)) == NULL)
+                found = Walk_Free(First_Header(arena), rover, size);
+            return found;
+        case FIRST_FIT:
+        default:
+            return Walk_Free(First_Header(arena), NULL, size);
+    }
+}
+
+/**
+ * @brief Checks that ptr is the header of a block of the arena, in constant time
+ * 
+ * @param ptr   candidate header address
+ * @return      1 if a block starts at ptr, 0 if not
+ */
+int Valid_Block(MEM_ARENA *arena, void *ptr) {
+    // The heap may be growing under us, the end of heap header is not a block
+    unsigned last = __atomic_load_n(&arena->last, __ATOMIC_RELAXED);
+
+    if ((uintptr_t)ptr < (uintptr_t)First_Header(arena) ||
+        (uintptr_t)ptr >= (uintptr_t)Arena_At(arena, last))
+        return 0;
+    if ((uintptr_t)ptr % GRANULE) return 0;
+    return Is_Header(ptr);
+}
+
+/**
+ * @brief Merges a free block with the free block that physically follows it
+ *
+ * Both blocks must already be out of the index.  The footer is left to the caller.
+ *
+ * @param p     free block header, keeps its address
+ */
+void Merge_Next(BLOCK_HEADER *p) {
+    MEM_ARENA *arena = Arena_Of(p);
+    BLOCK_HEADER *next = Get_Next_Header(p);
+
+    // Set the next pointer as the next-next pointer
+    Set_Next_Pointer(p, Get_Next_Header(next));
+    Set_Size(p, Get_Block_Size(p));
+    Unmark_Header(next);
+
+    // The rover must never point into the middle of a block
+    if (arena->rover == Arena_Offset(arena, next)) arena->rover = Arena_Offset(arena, p);
+}
+
+// #################################################################################
+// ###############               Init Function                  ####################
+// #################################################################################
+
+/**
+ * @brief Reserves an ARENA_WINDOW aligned window of address space
+ *
+ * Nothing in the window is accessible until it is mapped over.
+ *
+ * @return  start of the window, NULL on failure
+ */
+unsigned char *Reserve_Window() {
+    unsigned char *space;
+    unsigned char *start;
+
+    // Reserve twice the window and give back what lies outside the aligned part
+    space = mmap(NULL, 2 * ARENA_WINDOW, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                 -1, 0);
+    if (MAP_FAILED == space) return NULL;
+    start = (unsigned char *)(((uintptr_t)space + ARENA_WINDOW - 1) & ~(ARENA_WINDOW - 1));
+    if (start != space) munmap(space, start - space);
+    munmap(start + ARENA_WINDOW, space + 2 * ARENA_WINDOW - (start + ARENA_WINDOW));
+    return start;
+}
+
+/**
+ * @brief Maps zeroed memory over part of a reserved window
+ *
+ * @param addr  page aligned address inside a window
+ * @param size  bytes to map, a multiple of the page size
+ * @return      0 on success, -1 on failure
+ */
+int Map_Zero(void *addr, unsigned size) {
+    int fd;
+    void *space_ptr;
+
+    /* Using mmap to allocate memory */
+    fd = open("/dev/zero", O_RDWR);
+    if (-1 == fd) {
+        fprintf(stderr, "Error:mem.c: Cannot open /dev/zero\n");
+        return -1;
+    }
+    space_ptr = mmap(addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == space_ptr) {
+        fprintf(stderr, "Error:mem.c: mmap cannot allocate space\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Maps heap memory over part of a reserved window the way the MEM_MAP_* flags ask
+ *
+ * Without flags this is Map_Zero.  MEM_MAP_HUGETLB and MEM_MAP_THP imply
+ * an anonymous mapping, MEM_MAP_POPULATE faults every page in right away
+ * and MEM_MAP_LOCK keeps them from being paged out.
+ *
+ * @param addr  address inside a window, aligned to the mapping unit of the flags
+ * @param size  bytes to map, a multiple of the mapping unit
+ * @param flags MEM_MAP_* flags
+ * @return      0 on success, -1 on failure
+ */
+int Map_Heap(void *addr, unsigned size, int flags) {
+    int fd = -1;
+    int mmap_flags = MAP_PRIVATE | MAP_FIXED;
+    void *space_ptr;
+
+    if (flags == 0) return Map_Zero(addr, size);
+
+    if (flags & (MEM_MAP_ANONYMOUS | MEM_MAP_HUGETLB | MEM_MAP_THP))
+        mmap_flags |= MAP_ANONYMOUS;
+    else if ((fd = open("/dev/zero", O_RDWR)) == -1) {
+        fprintf(stderr, "Error:mem.c: Cannot open /dev/zero\n");
+        return -1;
+    }
+    if (flags & MEM_MAP_HUGETLB) mmap_flags |= MAP_HUGETLB;
+    if (flags & MEM_MAP_POPULATE) mmap_flags |= MAP_POPULATE;
+
+    space_ptr = mmap(addr, size, PROT_READ | PROT_WRITE, mmap_flags, fd, 0);
+    if (fd != -1) close(fd);
+    if (MAP_FAILED == space_ptr) {
+        fprintf(stderr, "Error:mem.c: mmap cannot allocate space%s\n",
+                flags & MEM_MAP_HUGETLB ? ", are huge pages reserved?" : "");
+        return -1;
+    }
+
+    // Only a hint, the kernel may not have transparent huge pages turned on
+    if (flags & MEM_MAP_THP) madvise(addr, size, MADV_HUGEPAGE);
+    if ((flags & MEM_MAP_LOCK) && mlock(addr, size) != 0) {
+        fprintf(stderr, "Error:mem.c: mlock failed, check RLIMIT_MEMLOCK\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the MEM_MAP_* flags the MEM_ARENA and the header bitmap are mapped with
+ *
+ * They are never shared, so they are always anonymous, and never huge
+ * pages, which the bitmap is too small to fill.  They are prefaulted and
+ * locked along with the heap.
+ */
+int Bitmap_Map_Flags(int flags) {
+    return MEM_MAP_ANONYMOUS | (flags & (MEM_MAP_POPULATE | MEM_MAP_LOCK));
+}
+
+/**
+ * @brief Maps a file over a whole window, MAP_SHARED
+ *
+ * Offsets in the window are offsets in the file.  The file may be shorter
+ * than the window, only the part inside the file may be touched.
+ *
+ * @param window    start of a reserved window
+ * @param fd        file to map, open for reading and writing
+ * @return          0 on success, -1 on failure
+ */
+int Map_File(unsigned char *window, int fd) {
+    if (MAP_FAILED ==
+        mmap(window, ARENA_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)) {
+        fprintf(stderr, "Error:mem.c: mmap cannot map the heap file\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Allocates disk space for part of a heap file, making the file longer if needed
+ *
+ * Reserving the space up front turns a full disk into a failed allocation
+ * instead of a SIGBUS on the first write.
+ *
+ * @return  0 on success, -1 on failure
+ */
+int File_Extend(int fd, unsigned offset, unsigned size) {
+    if (posix_fallocate(fd, offset, size) != 0) {
+        fprintf(stderr, "Error:mem.c: cannot make room in the heap file\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds an arena to arena_list and gives it a serial
+ *
+ * @param arena the arena
+ * @param fd    file behind the arena, -1 for none
+ * @return      0 on success, -1 if there are MAX_ARENAS arenas already
+ */
+int Arena_Register(MEM_ARENA *arena, int fd) {
+    int slot;
+
+    pthread_mutex_lock(&arena_list_lock);
+    for (slot = 0; slot < MAX_ARENAS && arena_list[slot] != NULL; slot++)
+        ;
+    if (slot == MAX_ARENAS) {
+        pthread_mutex_unlock(&arena_list_lock);
+        fprintf(stderr, "Error:mem.c: too many arenas\n");
+        return -1;
+    }
+    arena->serial = ++arena_serial;
+    arena_files[slot] = fd;
+    __atomic_store_n(&arena_list[slot], arena, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&arena_list_lock);
+    return 0;
+}
+
+/**
+ * @brief Returns the file behind a live arena
+ *
+ * Called with the arena lock held, so it does not take arena_list_lock.
+ * The entry of a live arena does not change, the others are read atomically.
+ *
+ * @return  the file descriptor, -1 if the arena does not live in a file
+ */
+int Arena_File(MEM_ARENA *arena) {
+    for (int i = 0; i < MAX_ARENAS; i++)
+        if (__atomic_load_n(&arena_list[i], __ATOMIC_ACQUIRE) == arena) return arena_files[i];
+    return -1;
+}
+
+/**
+ * @brief Sets up the lock of an arena, one that works across processes for arenas in a file
+ */
+void Arena_Lock_Init(MEM_ARENA *arena) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    if (arena->file) pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&arena->lock, &attr);
+    pthread_mutex_init(&arena->large_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/**
+ * @brief Checks that an arena has not been destroyed
+ *
+ * The caller holds arena_list_lock.
+ *
+ * @param arena     arena to look for
+ * @param serial    serial the arena had when it was last seen
+ * @return          1 if the arena is still alive, 0 if not
+ */
+int Arena_Alive(MEM_ARENA *arena, unsigned serial) {
+    for (int i = 0; i < MAX_ARENAS; i++)
+        if (arena_list[i] == arena) return arena->serial == serial;
+    return 0;
+}
+
+/**
+ * @brief Maps a new arena with one big free block and adds it to arena_list
+ *
+ * @param alloc_size    size of the heap, a multiple of the page size
+ * @param policy        fitting policy of the arena
+ * @param flags         MEM_MAP_* flags to map the heap with, ARENA_SHARED for shared memory
+ * @param fd            empty file to keep the arena in, -1 for memory of its own
+ * @return              the arena, NULL on failure
+ */
+MEM_ARENA *Arena_Create(int alloc_size, enum POLICY policy, int flags, int fd) {
+    unsigned bitmap_offset;
+    unsigned bitmap_size;
+    unsigned heap_offset;
+    unsigned char *window;
+    unsigned map_unit = getpagesize();
+    MEM_ARENA *arena;
+    BLOCK_HEADER *first_header;
+    BLOCK_HEADER *last_header;
+
+    if ((flags & ~(MEM_MAP_ALL | ARENA_SHARED)) || ((flags & ARENA_SHARED) && fd == -1)) {
+        fprintf(stderr, "Error:mem.c: unknown mapping flags\n");
+        return NULL;
+    }
+
+    // Huge pages need the heap aligned to them, explicit ones need whole huge pages too
+    if (flags & MEM_MAP_HUGETLB) {
+        map_unit = HUGE_PAGE_SIZE;
+        if ((unsigned)alloc_size > HEAP_MAX - map_unit) return NULL;
+        alloc_size = Pad_Unit(alloc_size, map_unit);
+    }
+
+    // One bit per granule of the heap, only the part covering the heap is mapped for now
+    bitmap_offset = Pad_Page(sizeof(MEM_ARENA));
+    bitmap_size = Pad_Page((alloc_size / GRANULE + 31) / 32 * sizeof(unsigned));
+    heap_offset = bitmap_offset + HEAP_MAX / GRANULE / 8;
+    if (flags & (MEM_MAP_HUGETLB | MEM_MAP_THP))
+        heap_offset = Pad_Unit(heap_offset, HUGE_PAGE_SIZE);
+
+    if ((window = Reserve_Window()) == NULL) {
+        fprintf(stderr, "Error:mem.c: cannot reserve address space for the arena\n");
+        return NULL;
+    }
+    if (fd != -1) {
+        // The bitmap space the heap has not grown into yet stays a hole in the file
+        if (File_Extend(fd, 0, bitmap_offset + bitmap_size) != 0 ||
+            File_Extend(fd, heap_offset, alloc_size) != 0 || Map_File(window, fd) != 0) {
+            munmap(window, ARENA_WINDOW);
+            return NULL;
+        }
+    } else if (Map_Heap(window, bitmap_offset + bitmap_size, Bitmap_Map_Flags(flags)) != 0 ||
+               Map_Heap(window + heap_offset, alloc_size, flags) != 0) {
+        munmap(window, ARENA_WINDOW);
+        return NULL;
+    }
+
+    arena = (MEM_ARENA *)window;
+    arena->policy = policy;
+    arena->file = fd != -1;
+    arena->shared = (flags & ARENA_SHARED) != 0;
+    Arena_Lock_Init(arena);
+    arena->bitmap = bitmap_offset;
+    arena->bitmap_size = bitmap_size;
+    arena->size = alloc_size;
+    arena->max_size = alloc_size;
+    arena->map_flags = flags & MEM_MAP_ALL;
+    arena->map_unit = map_unit;
+    arena->mmap_threshold = fd != -1 ? 0 : DEFAULT_MMAP_THRESHOLD;
+    arena->first = heap_offset;
+    arena->last = heap_offset + alloc_size - sizeof(BLOCK_HEADER);
+
+    // To begin with, there is only one big, free block.
+    // Initialize the first header */
+    first_header = First_Header(arena);
+    // free size
+    // Remember that the 'size' stored for free blocks excludes the space for the headers
+    first_header->size = (unsigned)alloc_size - 2 * sizeof(BLOCK_HEADER);
+    // offset of last header
+    first_header->packed_offset = arena->last;
+
+    // initialize last header
+    last_header = Last_Header(arena);
+    Init_Header(last_header);
+
+    // the one big free block is all there is to search
+    Set_Footer(first_header);
+    Set_Prev_Free(last_header);
+    Mark_Header(first_header);
+    Mark_Header(last_header);
+    arena->rover = arena->first;
+    Index_Insert(first_header);
+
+    // The magic goes in last, a file left half set up is not taken for a heap
+    if (fd != -1) {
+        arena->dirty = !arena->shared;
+        arena->layout = sizeof(MEM_ARENA);
+        __atomic_store_n(&arena->magic, FILE_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    if (Arena_Register(arena, fd) != 0) {
+        munmap(window, ARENA_WINDOW);
+        return NULL;
+    }
+    return arena;
+}
+
+/**
+ **  Function used to Initialize the memory allocator.
+ *!  Do not change this function.
+ *  Written by Cherin Joseph, Modified by Michael Doescher.
+ *
+ *!  Not intended to be called more than once by a program.
+ *
+ *?  Notes we're using mmap here instead of sbrk as in the book to take advantage of caching
+ *?  as described in the OS lectures.
+ *
+ *  The heap set up here becomes the default arena used by Mem_Alloc and Mem_Free,
+ *  study the end of Arena_Create where the headers are initialized for hints!
+ *
+ *  @param sizeOfRegion:  Specifies the size of the chunk which needs to be allocated
+ *  @param policy_input:  indicates the policy to use eg: best fit is 0
+ *  @return            :  0 on success, -1 on failure
+ */
+int Mem_Init(int sizeOfRegion, enum POLICY policy_input) {
+    int pagesize;
+    int padsize;
+    int alloc_size;
+
+    if (0 != allocated_once) {
+        fprintf(stderr, "Error:mem.c: Mem_Init has allocated space during a previous call\n");
+        return -1;
+    }
+    if (sizeOfRegion <= 0) {
+        fprintf(stderr, "Error:mem.c: Requested block size is not positive\n");
+        return -1;
+    }
+
+    /* Calculate padsize as the padding required to round up sizeOfRegion to a multiple of pagesize
+     */
+    pagesize = getpagesize();  //  Get the pagesize
+    padsize = sizeOfRegion % pagesize;
+    padsize = (pagesize - padsize) % pagesize;
+    alloc_size = sizeOfRegion + padsize;
+
+    printf("requested size: %i\tallocated sise: %i\n", sizeOfRegion, alloc_size);
+
+    if ((default_arena = Arena_Create(alloc_size, policy_input, 0, -1)) == NULL) return -1;
+
+    allocated_once = 1;
+    return 0;
+}
+
+/**
+ * @brief Sets up the default arena like Mem_Init, with control over how the heap is mapped
+ *
+ * The flags trade startup cost for steady state latency: MEM_MAP_POPULATE
+ * and MEM_MAP_LOCK pay for every page fault up front, MEM_MAP_HUGETLB and
+ * MEM_MAP_THP cut TLB misses on large heaps.  They apply to the memory the
+ * heap grows by as well.
+ *
+ * @param sizeOfRegion  size of the heap, rounded up to whole pages (huge pages with HUGETLB)
+ * @param policy_input  fitting policy
+ * @param flags         MEM_MAP_* flags, 0 maps the heap the way Mem_Init does
+ * @return              0 on success, -1 on failure
+ */
+int Mem_Init_Flags(int sizeOfRegion, enum POLICY policy_input, int flags) {
+    if (0 != allocated_once) {
+        fprintf(stderr, "Error:mem.c: Mem_Init has allocated space during a previous call\n");
+        return -1;
+    }
+    if (sizeOfRegion <= 0 || sizeOfRegion > INT32_MAX - getpagesize()) {
+        fprintf(stderr, "Error:mem.c: Requested block size is not positive\n");
+        return -1;
+    }
+
+    if ((default_arena = Arena_Create(Pad_Page(sizeOfRegion), policy_input, flags, -1)) == NULL)
+        return -1;
+
+    allocated_once = 1;
+    return 0;
+}
+
+/**
+ * @brief Creates an arena independent of the default one and of each other
+ *
+ * Blocks of the arena are allocated with Mem_Arena_Alloc and freed with
+ * Mem_Arena_Free; the arena has its own lock, so threads working in different
+ * arenas never wait for each other.
+ *
+ * @param sizeOfRegion  size of the heap, rounded up to whole pages
+ * @param policy        fitting policy of the arena
+ * @return              handle of the arena, NULL on failure
+ */
+MEM_ARENA *Mem_Arena_Create(int sizeOfRegion, enum POLICY policy) {
+    return Mem_Arena_Create_Flags(sizeOfRegion, policy, 0);
+}
+
+/**
+ * @brief Creates an arena whose heap is mapped the way the MEM_MAP_* flags ask
+ *
+ * @param sizeOfRegion  size of the heap, rounded up to whole pages (huge pages with HUGETLB)
+ * @param policy        fitting policy of the arena
+ * @param flags         MEM_MAP_* flags, see Mem_Init_Flags
+ * @return              handle of the arena, NULL on failure
+ */
+MEM_ARENA *Mem_Arena_Create_Flags(int sizeOfRegion, enum POLICY policy, int flags) {
+    if (sizeOfRegion <= 0 || sizeOfRegion > INT32_MAX - getpagesize()) return NULL;
+    return Arena_Create(Pad_Page(sizeOfRegion), policy, flags, -1);
+}
+
+/**
+ * @brief Lets the heap of an arena grow when it runs out of space
+ *
+ * The heap starts out with the size it was created with and never grows
+ * past maxSize.  The memory is only mapped once an allocation needs it.
+ *
+ * @param arena     arena to change
+ * @param maxSize   largest size of the heap, rounded up to whole pages
+ * @return          0 on success, -1 if maxSize is smaller than the heap already is
+ */
+int Mem_Arena_Set_Max_Size(MEM_ARENA *arena, int maxSize) {
+    int ret = -1;
+
+    if (arena == NULL || maxSize <= 0) return -1;
+
+    pthread_mutex_lock(&arena->lock);
+    if (Pad_Page(maxSize) >= arena->size) {
+        arena->max_size = Pad_Page(maxSize);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    return ret;
+}
+
+/**
+ * @brief Lets the heap of the default arena grow, see Mem_Arena_Set_Max_Size
+ */
+int Mem_Set_Max_Size(int maxSize) { return Mem_Arena_Set_Max_Size(default_arena, maxSize); }
+
+// #################################################################################
+// ###############                  Heap Files                  ####################
+// #################################################################################
+
+/**
+ ** A heap file holds an arena exactly as it lies in its window: the
+ ** MEM_ARENA, the header bitmap (with a hole where the heap has not grown
+ ** yet) and the heap.  Reopening it maps the file at a fresh window, and
+ ** since the block list, the free index and the slabs only hold offsets,
+ ** every object is where it was, relative to the arena.  Objects that point
+ ** at each other must do the same and store offsets, or distances from the
+ ** root object, rather than addresses.
+ **
+ ** A heap file can be open in one process at a time, which flock enforces.
+ ** The dirty flag is set while it is open and cleared once Mem_Arena_Destroy
+ ** has written everything back, so a file left behind by a process that
+ ** died in the middle of an allocation is refused instead of trusted.
+ **
+ ** Everything a heap file arena hands out lives in the file: it never maps
+ ** large blocks of their own and small objects skip the thread caches.
+ */
+
+/**
+ * @brief Maps an existing heap file or shared memory arena and checks that it can be used
+ *
+ * @param fd        the file, open for reading and writing
+ * @param shared    1 to attach to shared memory, 0 for a heap file
+ * @return          the arena, NULL if the file is not the kind asked for or was not closed cleanly
+ */
+MEM_ARENA *Arena_Attach(int fd, int shared) {
+    struct stat st;
+    unsigned char *window;
+    MEM_ARENA *arena;
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MEM_ARENA)) {
+        fprintf(stderr, "Error:mem.c: not a heap file\n");
+        return NULL;
+    }
+    if ((window = Reserve_Window()) == NULL) {
+        fprintf(stderr, "Error:mem.c: cannot reserve address space for the arena\n");
+        return NULL;
+    }
+    if (Map_File(window, fd) != 0) {
+        munmap(window, ARENA_WINDOW);
+        return NULL;
+    }
+
+    arena = (MEM_ARENA *)window;
+    if (__atomic_load_n(&arena->magic, __ATOMIC_ACQUIRE) != FILE_MAGIC ||
+        arena->layout != sizeof(MEM_ARENA) || arena->shared != (unsigned)shared) {
+        fprintf(stderr, "Error:mem.c: not a heap file\n");
+        munmap(window, ARENA_WINDOW);
+        return NULL;
+    }
+    if (shared) {
+        // Other processes keep working on it, its lock included
+        if (Arena_Register(arena, fd) != 0) {
+            munmap(window, ARENA_WINDOW);
+            return NULL;
+        }
+        return arena;
+    }
+
+    if (st.st_size < (off_t)arena->first + arena->size) {
+        fprintf(stderr, "Error:mem.c: not a heap file\n");
+        munmap(window, ARENA_WINDOW);
+        return NULL;
+    }
+    if (arena->dirty) {
+        fprintf(stderr, "Error:mem.c: heap file was not closed cleanly\n");
+        munmap(window, ARENA_WINDOW);
+        return NULL;
+    }
+
+    // The lock of the last process is meaningless here
+    Arena_Lock_Init(arena);
+    arena->dirty = 1;
+    if (Arena_Register(arena, fd) != 0) {
+        arena->dirty = 0;
+        munmap(window, ARENA_WINDOW);
+        return NULL;
+    }
+    return arena;
+}
+
+/**
+ * @brief Opens an arena kept in a file, creating the file if it does not exist
+ *
+ * A new or empty file gets a heap of sizeOfRegion bytes with the given
+ * policy.  An existing heap file is reattached as it was left, with the
+ * policy and maximum size it was made with, and the arguments are ignored.
+ * Mem_Arena_Destroy closes the file again.
+ *
+ * @param path          the heap file
+ * @param sizeOfRegion  size of a new heap, rounded up to whole pages
+ * @param policy        fitting policy of a new heap
+ * @return              handle of the arena, NULL on failure
+ */
+MEM_ARENA *Mem_Arena_Open_File(const char *path, int sizeOfRegion, enum POLICY policy) {
+    struct stat st;
+    MEM_ARENA *arena;
+    int fd;
+
+    if (path == NULL) return NULL;
+    if ((fd = open(path, O_RDWR | O_CREAT, 0600)) == -1) {
+        fprintf(stderr, "Error:mem.c: Cannot open %s\n", path);
+        return NULL;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error:mem.c: %s is in use by another process\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    if (st.st_size != 0) {
+        arena = Arena_Attach(fd, 0);
+    } else if (sizeOfRegion <= 0 || sizeOfRegion > INT32_MAX - getpagesize()) {
+        arena = NULL;
+    } else if ((arena = Arena_Create(Pad_Page(sizeOfRegion), policy, 0, fd)) == NULL) {
+        // Leave the file empty so the next attempt starts over
+        ftruncate(fd, 0);
+    }
+
+    if (arena == NULL) close(fd);
+    return arena;
+}
+
+/**
+ * @brief Sets up the default arena in a file, see Mem_Arena_Open_File
+ *
+ * @param path          the heap file
+ * @param sizeOfRegion  size of a new heap
+ * @param policy_input  fitting policy of a new heap
+ * @return              0 on success, -1 on failure
+ */
+int Mem_Init_File(const char *path, int sizeOfRegion, enum POLICY policy_input) {
+    if (0 != allocated_once) {
+        fprintf(stderr, "Error:mem.c: Mem_Init has allocated space during a previous call\n");
+        return -1;
+    }
+    if ((default_arena = Mem_Arena_Open_File(path, sizeOfRegion, policy_input)) == NULL) return -1;
+
+    allocated_once = 1;
+    return 0;
+}
+
+/**
+ * @brief Tears down the default arena, closing its heap file cleanly if it has one
+ *
+ * Afterwards Mem_Init or Mem_Init_File may set up a new default arena.
+ *
+ * @return  0 on success, -1 if there is no default arena
+ */
+int Mem_Close() {
+    if (Mem_Arena_Destroy(default_arena) != 0) return -1;
+    allocated_once = 0;
+    return 0;
+}
+
+/**
+ * @brief Sets the root object of an arena, the object a reopened heap file starts from
+ *
+ * @param arena arena to change
+ * @param ptr   an object of the arena, NULL for none
+ * @return      0 on success, -1 if ptr does not lie in the arena
+ */
+int Mem_Arena_Set_Root(MEM_ARENA *arena, void *ptr) {
+    if (arena == NULL || (ptr != NULL && Arena_Of(ptr) != arena)) return -1;
+    __atomic_store_n(&arena->root, Arena_Offset(arena, ptr), __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @brief Returns the root object of an arena
+ *
+ * @return  the root object, NULL if there is none
+ */
+void *Mem_Arena_Get_Root(MEM_ARENA *arena) {
+    if (arena == NULL) return NULL;
+    return Arena_At(arena, __atomic_load_n(&arena->root, __ATOMIC_ACQUIRE));
+}
+
+int Mem_Set_Root(void *ptr) { return Mem_Arena_Set_Root(default_arena, ptr); }
+
+void *Mem_Get_Root() { return Mem_Arena_Get_Root(default_arena); }
+
+// #################################################################################
+// ###############                Shared Memory                 ####################
+// #################################################################################
+
+/**
+ ** A shared memory arena is a heap file in shm_open or memfd_create memory
+ ** that any number of processes have mapped at once, each at its own
+ ** window.  The arena lock is process-shared, so every process allocates
+ ** and frees as if the others were threads, and a heap one process grows
+ ** is seen by all of them, since their windows map the whole file.
+ **
+ ** Addresses differ from process to process, the offset of an object does
+ ** not: one process hands over Mem_Arena_Offset of a buffer, the other
+ ** turns it back with Mem_Arena_Pointer and works on the same memory, no
+ ** copy made.  A process that dies holding the lock leaves the others
+ ** waiting forever, and the arena goes away with its name and the last
+ ** process that has it mapped.
+ */
+
+/**
+ * @brief Creates an arena in shared memory
+ *
+ * With a name, other processes attach with Mem_Arena_Open_Shared and
+ * shm_unlink removes the name again.  Without one the memory is anonymous
+ * and only children forked afterwards share it, using the same handle.
+ *
+ * @param name          shm_open name like "/cache", NULL for anonymous memory
+ * @param sizeOfRegion  size of the heap, rounded up to whole pages
+ * @param policy        fitting policy of the arena
+ * @return              handle of the arena, NULL on failure or if the name is taken
+ */
+MEM_ARENA *Mem_Arena_Create_Shared(const char *name, int sizeOfRegion, enum POLICY policy) {
+    MEM_ARENA *arena;
+    int fd;
+
+    if (sizeOfRegion <= 0 || sizeOfRegion > INT32_MAX - getpagesize()) return NULL;
+
+    fd = name ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : memfd_create("libmem", 0);
+    if (fd == -1) {
+        fprintf(stderr, "Error:mem.c: cannot create shared memory\n");
+        return NULL;
+    }
+    if ((arena = Arena_Create(Pad_Page(sizeOfRegion), policy, ARENA_SHARED, fd)) == NULL) {
+        if (name) shm_unlink(name);
+        close(fd);
+    }
+    return arena;
+}
+
+/**
+ * @brief Attaches to a shared memory arena another process created
+ *
+ * @param name  the name passed to Mem_Arena_Create_Shared
+ * @return      handle of the arena, NULL on failure
+ */
+MEM_ARENA *Mem_Arena_Open_Shared(const char *name) {
+    MEM_ARENA *arena;
+    int fd;
+
+    if (name == NULL) return NULL;
+    if ((fd = shm_open(name, O_RDWR, 0)) == -1) {
+        fprintf(stderr, "Error:mem.c: Cannot open %s\n", name);
+        return NULL;
+    }
+    if ((arena = Arena_Attach(fd, 1)) == NULL) close(fd);
+    return arena;
+}
+
+/**
+ * @brief Returns the offset of an object from its arena, the same in every process
+ *
+ * @param arena arena the object belongs to
+ * @param ptr   an object of the heap of the arena
+ * @return      the offset, 0 if ptr is NULL or not in the arena
+ */
+unsigned Mem_Arena_Offset(MEM_ARENA *arena, void *ptr) {
+    if (arena == NULL || ptr == NULL || Arena_Of(ptr) != arena) return 0;
+    return Arena_Offset(arena, ptr);
+}
+
+/**
+ * @brief Turns an offset from Mem_Arena_Offset back into an address of this process
+ *
+ * @param arena     arena the object belongs to
+ * @param offset    offset of the object
+ * @return          the object, NULL if the offset is 0 or outside the heap
+ */
+void *Mem_Arena_Pointer(MEM_ARENA *arena, unsigned offset) {
+    if (arena == NULL || offset < arena->first ||
+        offset >= arena->first + __atomic_load_n(&arena->size, __ATOMIC_RELAXED))
+        return NULL;
+    return Arena_At(arena, offset);
+}
+
+// #################################################################################
+// ###############                Slab Allocator                ####################
+// #################################################################################
+
+void *Heap_Alloc_Aligned(MEM_ARENA *arena, int size, int alignment);
+void Heap_Free(BLOCK_HEADER *free);
+
+/**
+ * Returns the slab an object belongs to
+ */
+SLAB *Slab_Of(void *p) { return (SLAB *)((uintptr_t)p & ~(uintptr_t)(SLAB_SIZE - 1)); }
+
+/**
+ * Returns the size class of objects of 'size' bytes, size a multiple of GRANULE
+ */
+int Slab_Class(int size) { return size / GRANULE - 1; }
+
+/**
+ * Returns how many objects of 'size' bytes fit in a slab
+ */
+int Slab_Capacity(unsigned size) { return (SLAB_SIZE - SLAB_HEADER_SIZE) / size; }
+
+/**
+ * @brief Finds which object of a slab of the arena starts at p
+ *
+ * Safe without the arena lock, the block holding the slab is checked like
+ * any block passed to Mem_Free before the slab is looked at.
+ *
+ * @param   p    candidate object address
+ * @return  index of the object, -1 if p is not the start of an object
+ */
+int Slab_Index(MEM_ARENA *arena, void *p) {
+    SLAB *slab = Slab_Of(p);
+    BLOCK_HEADER *block = Get_Header_From_User_Pointer(slab);
+    unsigned offset = (unsigned char *)p - (unsigned char *)slab;
+    unsigned size;
+
+    if (!Valid_Block(arena, block) || Is_Free(block) || !Is_Slab(block)) return -1;
+    size = slab->size;
+    if (offset < SLAB_HEADER_SIZE || (offset - SLAB_HEADER_SIZE) % size != 0) return -1;
+    if ((int)((offset - SLAB_HEADER_SIZE) / size) >= Slab_Capacity(size)) return -1;
+    return (offset - SLAB_HEADER_SIZE) / size;
+}
+
+/**
+ * Sets bit i of a bitmap, returns the old value of the bit
+ */
+int Bit_Set(unsigned *map, int i) {
+    return (__atomic_fetch_or(&map[i / 32], 1U << (i % 32), __ATOMIC_RELAXED) >> (i % 32)) & 1;
+}
+
+/**
+ * Clears bit i of a bitmap, returns the old value of the bit
+ */
+int Bit_Clear(unsigned *map, int i) {
+    return (__atomic_fetch_and(&map[i / 32], ~(1U << (i % 32)), __ATOMIC_RELAXED) >> (i % 32)) & 1;
+}
+
+/**
+ * Checks bit i of a bitmap
+ */
+int Bit_Test(unsigned *map, int i) {
+    return (__atomic_load_n(&map[i / 32], __ATOMIC_RELAXED) >> (i % 32)) & 1;
+}
+
+/**
+ * @brief Pushes a slab on the front of a slab list of its arena
+ *
+ * @param list  head of the list, an offset from the arena
+ */
+void Slab_Link(unsigned *list, SLAB *slab) {
+    MEM_ARENA *arena = Arena_Of(slab);
+
+    slab->prev = 0;
+    slab->next = *list;
+    if (*list != 0) ((SLAB *)Arena_At(arena, *list))->prev = Arena_Offset(arena, slab);
+    *list = Arena_Offset(arena, slab);
+}
+
+/**
+ * @brief Unlinks a slab from a slab list of its arena
+ *
+ * @param list  head of the list the slab is on
+ */
+void Slab_Unlink(unsigned *list, SLAB *slab) {
+    MEM_ARENA *arena = Arena_Of(slab);
+
+    if (slab->prev != 0)
+        ((SLAB *)Arena_At(arena, slab->prev))->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next != 0) ((SLAB *)Arena_At(arena, slab->next))->prev = slab->prev;
+}
+
+/**
+ * @brief Hands out an object of 'size' bytes, the caller holds the arena lock
+ *
+ * Takes a new slab from the heap when no slab of the class has room left.
+ *
+ * @param size  padded size, at most SLAB_MAX_SIZE
+ * @return      the object, NULL if the heap has no room for another slab
+ */
+void *Slab_Alloc(MEM_ARENA *arena, int size) {
+    int cls = Slab_Class(size);
+    SLAB *slab = Arena_At(arena, arena->slab_partial[cls]);
+    int i;
+
+    if (slab == NULL) {
+        if ((slab = Heap_Alloc_Aligned(arena, SLAB_SIZE, SLAB_SIZE)) == NULL) return NULL;
+        memset(slab, 0, sizeof(SLAB));
+        slab->size = size;
+        Set_Slab(Get_Header_From_User_Pointer(slab));
+        Slab_Link(&arena->slab_partial[cls], slab);
+        arena->slabs++;
+    }
+
+    // A slab on the list has a free object, the lowest clear bit is always below the capacity
+    for (i = 0; slab->used[i / 32] == ~0U; i += 32)
+        ;
+    i += __builtin_ctz(~slab->used[i / 32]);
+    Bit_Set(slab->used, i);
+    arena->slab_objects++;
+    arena->slab_bytes += size;
+
+    if ((int)++slab->count == Slab_Capacity(size))
+        Slab_Unlink(&arena->slab_partial[cls], slab);
+    return (unsigned char *)slab + SLAB_HEADER_SIZE + i * size;
+}
+
+/**
+ * @brief Takes an object back into its slab, the caller holds the arena lock
+ *
+ * A slab that runs empty goes back to the heap.
+ *
+ * @param p     an object in use, cached or not
+ */
+void Slab_Free(void *p) {
+    MEM_ARENA *arena = Arena_Of(p);
+    SLAB *slab = Slab_Of(p);
+    int i = Slab_Index(arena, p);
+    int cls = Slab_Class(slab->size);
+
+    Bit_Clear(slab->cached, i);
+    Bit_Clear(slab->used, i);
+    arena->slab_objects--;
+    arena->slab_bytes -= slab->size;
+
+    if ((int)slab->count-- == Slab_Capacity(slab->size))
+        Slab_Link(&arena->slab_partial[cls], slab);
+    if (slab->count == 0) {
+        BLOCK_HEADER *block = Get_Header_From_User_Pointer(slab);
+
+        Slab_Unlink(&arena->slab_partial[cls], slab);
+        arena->slabs--;
+        Clear_Slab(block);
+        Heap_Free(block);
+    }
+}
+
+/**
+ * @brief Marks an object as freed into a thread cache, safe without the arena lock
+ *
+ * @param p     candidate object address
+ * @return      0 on success, -1 if p is not an object in use or is cached already
+ */
+int Slab_Set_Cached(MEM_ARENA *arena, void *p) {
+    int i = Slab_Index(arena, p);
+
+    if (i < 0 || !Bit_Test(Slab_Of(p)->used, i)) return -1;
+    return Bit_Set(Slab_Of(p)->cached, i) ? -1 : 0;
+}
+
+/**
+ * Marks a cached object as in use again
+ */
+void Slab_Clear_Cached(MEM_ARENA *arena, void *p) {
+    Bit_Clear(Slab_Of(p)->cached, Slab_Index(arena, p));
+}
+
+// #################################################################################
+// ###############                 Thread Cache                 ####################
+// #################################################################################
+
+/**
+ ** Each thread keeps the small objects it frees in a cache, one LIFO list per
+ ** slab size class, so a thread that keeps allocating and freeing small
+ ** objects does not touch the arena lock at all.
+ **
+ ** Cached objects stay in use as far as their slab is concerned and carry
+ ** the cached bit, which is how a second Mem_Free of the same pointer is
+ ** still caught.  The list link is kept in the object itself.
+ ** A list is flushed back to the slabs by half once it grows past CACHE_LIMIT,
+ ** and a thread's whole cache is flushed when the thread exits or calls
+ ** Mem_Cache_Flush.
+ **
+ ** The cache has CACHE_ARENAS slots, an arena uses the slot picked by its
+ ** serial.  When another arena claims a slot, the objects already in it are
+ ** handed back to their own arena first, unless that arena has been
+ ** destroyed in the meantime, which arena_list tells.
+ */
+#define CACHE_LIMIT 32
+#define CACHE_ARENAS 4
+
+typedef struct CACHE_SLOT {
+    MEM_ARENA *arena;           // arena the cached objects belong to, NULL if unused
+    unsigned serial;            // serial of that arena
+    void *bins[SLAB_CLASSES];   // cached objects of each class, linked through the objects
+    int counts[SLAB_CLASSES];   // number of objects in each bin
+    int allocs;                 // allocations from the slot not yet counted in the arena
+    int frees;                  // frees into the slot not yet counted in the arena
+} CACHE_SLOT;
+
+typedef struct THREAD_CACHE {
+    CACHE_SLOT slots[CACHE_ARENAS];
+    int registered;  // the exit destructor has been set up for this thread
+} THREAD_CACHE;
+
+__thread THREAD_CACHE thread_cache;
+pthread_key_t cache_key;  // only used for its destructor, which flushes an exiting thread
+pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Returns the next object in a bin, stored in the cached object itself
+ */
+void **Cache_Link(void *p) { return (void **)p; }
+
+/**
+ * Returns the slot of the calling thread's cache an arena uses
+ */
+CACHE_SLOT *Cache_Slot(MEM_ARENA *arena) {
+    return &thread_cache.slots[arena->serial % CACHE_ARENAS];
+}
+
+/**
+ * @brief Adds the allocations and frees a slot has seen to the counters of its arena
+ *
+ * Slots only do this every CACHE_LIMIT operations, so the fast path does
+ * not write to the arena on every call.
+ *
+ * @param slot  slot of the calling thread's cache, its arena must be alive
+ */
+void Cache_Count(CACHE_SLOT *slot) {
+    Stats_Count(&slot->arena->alloc_count, slot->allocs);
+    Stats_Count(&slot->arena->free_count, slot->frees);
+    slot->allocs = 0;
+    slot->frees = 0;
+}
+
+void Remote_Push(MEM_ARENA *arena, void *ptr);
+void Remote_Drain(MEM_ARENA *arena);
+
+/**
+ * @brief Returns up to 'count' objects of one bin to their slabs
+ *
+ * Never waits for the arena lock, when another thread holds it the objects
+ * go onto the remote free list for that thread to free.
+ *
+ * @param slot  slot holding the bin, its arena must be alive
+ * @param cls   bin to flush
+ * @param count how many objects to flush at most
+ */
+void Cache_Flush_Class(CACHE_SLOT *slot, int cls, int count) {
+    // A cached object already carries the cached bit, it can go on the remote list as it is
+    int locked = pthread_mutex_trylock(&slot->arena->lock) == 0;
+
+    if (locked) Remote_Drain(slot->arena);
+    while (count-- > 0 && slot->bins[cls] != NULL) {
+        void *p = slot->bins[cls];
+        slot->bins[cls] = *Cache_Link(p);
+        slot->counts[cls]--;
+        if (locked)
+            Slab_Free(p);
+        else
+            Remote_Push(slot->arena, p);
+    }
+    if (locked) pthread_mutex_unlock(&slot->arena->lock);
+}
+
+/**
+ * @brief Returns the objects of a slot to their arena, if it is still alive, and empties the slot
+ *
+ * @param slot  slot of the calling thread's cache
+ */
+void Cache_Release(CACHE_SLOT *slot) {
+    if (slot->arena == NULL) return;
+
+    // Holding the list lock keeps the arena from being destroyed under the flush
+    pthread_mutex_lock(&arena_list_lock);
+    if (Arena_Alive(slot->arena, slot->serial)) {
+        Cache_Count(slot);
+        for (int cls = 0; cls < SLAB_CLASSES; cls++)
+            if (slot->bins[cls] != NULL) Cache_Flush_Class(slot, cls, slot->counts[cls]);
+    }
+    pthread_mutex_unlock(&arena_list_lock);
+    memset(slot, 0, sizeof(CACHE_SLOT));
+}
+
+/**
+ * @brief Returns every object cached by the calling thread to its slab
+ */
+void Mem_Cache_Flush() {
+    for (int i = 0; i < CACHE_ARENAS; i++) Cache_Release(&thread_cache.slots[i]);
+}
+
+/**
+ * Thread exit destructor, hands the exiting thread's objects back to their slabs
+ */
+void Cache_Destructor(void *unused) { Mem_Cache_Flush(); }
+
+void Cache_Make_Key() { pthread_key_create(&cache_key, Cache_Destructor); }
+
+/**
+ * @brief Parks a freed object in the calling thread's cache
+ *
+ * @param p     an object already marked cached with Slab_Set_Cached
+ */
+void Cache_Push(void *p) {
+    MEM_ARENA *arena = Arena_Of(p);
+    CACHE_SLOT *slot = Cache_Slot(arena);
+    int cls = Slab_Class(Slab_Of(p)->size);
+
+    if (!thread_cache.registered) {
+        // The destructor only runs for threads with a non-NULL value
+        pthread_once(&cache_key_once, Cache_Make_Key);
+        pthread_setspecific(cache_key, &thread_cache);
+        thread_cache.registered = 1;
+    }
+
+    if (slot->arena != arena || slot->serial != arena->serial) {
+        Cache_Release(slot);
+        slot->arena = arena;
+        slot->serial = arena->serial;
+    }
+
+    *Cache_Link(p) = slot->bins[cls];
+    slot->bins[cls] = p;
+    if (++slot->frees == CACHE_LIMIT) Cache_Count(slot);
+    if (++slot->counts[cls] > CACHE_LIMIT) Cache_Flush_Class(slot, cls, CACHE_LIMIT / 2);
+}
+
+/**
+ * @brief Takes an object of an arena from the calling thread's cache
+ *
+ * @param size  padded size, at most SLAB_MAX_SIZE
+ * @return      an object of exactly that size, NULL if the bin is empty
+ */
+void *Cache_Pop(MEM_ARENA *arena, int size) {
+    int cls = Slab_Class(size);
+    CACHE_SLOT *slot = Cache_Slot(arena);
+    void *p;
+
+    if (slot->arena != arena || slot->serial != arena->serial) return NULL;
+    if ((p = slot->bins[cls]) == NULL) return NULL;
+    slot->bins[cls] = *Cache_Link(p);
+    slot->counts[cls]--;
+    Slab_Clear_Cached(arena, p);
+    if (++slot->allocs == CACHE_LIMIT) Cache_Count(slot);
+    return p;
+}
+
+// #################################################################################
+// ###############                 Large Blocks                 ####################
+// #################################################################################
+
+/**
+ * @brief Sets the size from which requests to an arena are mapped on their own
+ *
+ * Such blocks never fragment the heap and their memory goes back to the
+ * system as soon as they are freed, at the cost of an mmap and a munmap.
+ *
+ * @param arena     arena to change
+ * @param threshold smallest request that is mapped, 0 to serve everything from the heap
+ * @return          0 on success, -1 on a negative threshold or a heap file arena, which
+ *                  keeps everything in the file
+ */
+int Mem_Arena_Set_Mmap_Threshold(MEM_ARENA *arena, int threshold) {
+    if (arena == NULL || threshold < 0 || (arena->file && threshold != 0)) return -1;
+    __atomic_store_n(&arena->mmap_threshold, threshold, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @brief Sets the mmap threshold of the default arena, see Mem_Arena_Set_Mmap_Threshold
+ */
+int Mem_Set_Mmap_Threshold(int threshold) {
+    return Mem_Arena_Set_Mmap_Threshold(default_arena, threshold);
+}
+
+/**
+ * Checks if a request goes to its own mapping instead of the heap
+ */
+int Is_Large(MEM_ARENA *arena, int size) {
+    unsigned threshold = __atomic_load_n(&arena->mmap_threshold, __ATOMIC_RELAXED);
+    return threshold != 0 && (unsigned)size >= threshold;
+}
+
+/**
+ * Returns the bytes mapped for a large block
+ */
+size_t Large_Map_Size(LARGE_HEADER *large) {
+    size_t pagesize = getpagesize();
+    size_t map_size = large->offset + (size_t)large->size;
+    return map_size + (pagesize - map_size % pagesize) % pagesize;
+}
+
+/**
+ * @brief Maps a block of its own for a large request
+ *
+ * @param arena     arena the block belongs to
+ * @param size      size requested by the user
+ * @param alignment power of two, at most the page size
+ * @return          the user writeable address of the block, NULL on failure
+ */
+void *Large_Alloc(MEM_ARENA *arena, int size, int alignment) {
+    LARGE_HEADER probe;
+    LARGE_HEADER *large;
+
+    probe.size = size;
+    probe.offset = alignment > (int)sizeof(LARGE_HEADER) ? alignment : sizeof(LARGE_HEADER);
+    large = mmap(NULL, Large_Map_Size(&probe), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == large) return NULL;
+    large->size = probe.size;
+    large->offset = probe.offset;
+    large->arena = arena;
+
+    pthread_mutex_lock(&arena->large_lock);
+    large->prev = NULL;
+    large->next = arena->large;
+    if (arena->large != NULL) arena->large->prev = large;
+    arena->large = large;
+    arena->large_blocks++;
+    arena->large_bytes += large->size;
+    arena->large_headers += large->offset;
+    arena->large_mapped += Large_Map_Size(large);
+    pthread_mutex_unlock(&arena->large_lock);
+    return (unsigned char *)large + large->offset;
+}
+
+/**
+ * @brief Finds the large block of an arena a user pointer belongs to, the caller holds large_lock
+ *
+ * The pointer is looked up on the list of large blocks of the arena, nothing
+ * it points to is read.  A stray pointer, one into memory that is mapped
+ * but cannot be read, or one to a block already unmapped is rejected
+ * instead of faulting.  The list is short, every block on it is at least
+ * the mmap threshold.
+ *
+ * @param ptr   candidate user pointer
+ * @return      header of the large block, NULL if ptr is not one
+ */
+LARGE_HEADER *Large_Header(MEM_ARENA *arena, void *ptr) {
+    LARGE_HEADER *large;
+
+    for (large = arena->large; large != NULL; large = large->next)
+        if ((unsigned char *)large + large->offset == ptr) return large;
+    return NULL;
+}
+
+/**
+ * @brief Unlinks a large block from its arena and unmaps it, the caller holds large_lock
+ *
+ * @param large header of a live large block
+ */
+void Large_Free(LARGE_HEADER *large) {
+    MEM_ARENA *arena = large->arena;
+
+    if (large->prev != NULL)
+        large->prev->next = large->next;
+    else
+        arena->large = large->next;
+    if (large->next != NULL) large->next->prev = large->prev;
+    arena->large_blocks--;
+    arena->large_bytes -= large->size;
+    arena->large_headers -= large->offset;
+    arena->large_mapped -= Large_Map_Size(large);
+
+    large->arena = NULL;
+    munmap(large, Large_Map_Size(large));
+}
+
+/**
+ * @brief Resizes a large block, the caller holds large_lock
+ *
+ * The kernel grows or shrinks the mapping in place when it can and moves its
+ * pages otherwise, the contents are never copied.
+ *
+ * @param large header of a live large block
+ * @param size  new size requested by the user
+ * @return      the user pointer of the block, which may have moved, NULL on failure
+ */
+void *Large_Resize(LARGE_HEADER *large, int size) {
+    MEM_ARENA *arena = large->arena;
+    LARGE_HEADER probe = *large;
+    LARGE_HEADER *moved;
+
+    probe.size = size;
+    moved = mremap(large, Large_Map_Size(large), Large_Map_Size(&probe), MREMAP_MAYMOVE);
+    if (MAP_FAILED == moved) return NULL;
+    arena->large_bytes += (size_t)size - moved->size;
+    arena->large_mapped += Large_Map_Size(&probe) - Large_Map_Size(moved);
+    moved->size = size;
+
+    if (moved->prev != NULL)
+        moved->prev->next = moved;
+    else
+        arena->large = moved;
+    if (moved->next != NULL) moved->next->prev = moved;
+    return (unsigned char *)moved + moved->offset;
+}
+
+// #################################################################################
+// ###############                 Remote Frees                 ####################
+// #################################################################################
+
+/**
+ ** A Mem_Free that finds the arena lock taken does not wait for it.  It
+ ** claims the block with one atomic operation, REMOTE_BIT in the size of a
+ ** heap block or the cached bit of a slab object, which still catches a
+ ** second free of the same pointer, and pushes it onto the remote free list
+ ** of the arena with a compare and swap.  The link to the next entry is
+ ** kept in the payload.  Whoever takes the lock next, typically a thread
+ ** allocating, takes the whole list with one exchange and frees the blocks
+ ** for real, coalescing them with their neighbours as usual.
+ **
+ ** Any number of threads push but only the lock holder pops, and it pops
+ ** everything at once, so the list needs no ABA protection.  It holds
+ ** offsets like everything else in the arena, so it works across the
+ ** processes of a shared arena too.
+ */
+
+void Heap_Free(BLOCK_HEADER *free);
+void Heap_Release(MEM_ARENA *arena, BLOCK_HEADER *block);
+
+/**
+ * Checks if a block of the heap sits on the remote free list
+ */
+int Is_Remote(BLOCK_HEADER *p) {
+    return (__atomic_load_n(&p->size, __ATOMIC_RELAXED) & REMOTE_BIT) != 0;
+}
+
+/**
+ * @brief Pushes a claimed block or object onto the remote free list, never blocks
+ *
+ * @param ptr   user pointer, already marked with REMOTE_BIT or the cached bit
+ */
+void Remote_Push(MEM_ARENA *arena, void *ptr) {
+    unsigned offset = Arena_Offset(arena, ptr);
+    unsigned head = __atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED);
+
+    do {
+        *(unsigned *)ptr = head;
+    } while (!__atomic_compare_exchange_n(&arena->remote_free, &head, offset, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief Frees everything on the remote free list, the caller holds the arena lock
+ */
+void Remote_Drain(MEM_ARENA *arena) {
+    unsigned offset;
+
+    if (__atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED) == 0) return;
+
+    offset = __atomic_exchange_n(&arena->remote_free, 0, __ATOMIC_ACQUIRE);
+    while (offset != 0) {
+        void *ptr = Arena_At(arena, offset);
+        BLOCK_HEADER *block = Get_Header_From_User_Pointer(ptr);
+
+        offset = *(unsigned *)ptr;
+        if (Valid_Block(arena, block)) {
+            __atomic_fetch_and(&block->size, ~REMOTE_BIT, __ATOMIC_RELAXED);
+            Heap_Release(arena, block);
+        } else {
+            Slab_Free(ptr);
+        }
+    }
+}
+
+/**
+ * @brief Takes the arena lock and frees what piled up on the remote free list meanwhile
+ */
+void Arena_Lock(MEM_ARENA *arena) {
+    pthread_mutex_lock(&arena->lock);
+    Remote_Drain(arena);
+}
+
+// #################################################################################
+// ###############             Deferred Coalescing              ####################
+// #################################################################################
+
+/**
+ ** In deferred mode a freed block of up to QUICK_MAX_SIZE bytes is not
+ ** coalesced or put in the index.  It stays allocated as far as the block
+ ** list is concerned, gets REMOTE_BIT like a block queued for freeing, and is
+ ** parked on a quick list for its exact block size.  An allocation of that
+ ** padded size takes it straight back, so a workload that frees and
+ ** reallocates the same sizes skips the coalescing, the splitting and the
+ ** index updates altogether.
+ **
+ ** Parked blocks are coalesced all at once when quick_limit of them have
+ ** piled up, and before the heap grows, so an allocation never fails for
+ ** want of a block that is only parked.  Until then they count as in use.
+ */
+
+/**
+ * @brief Frees every parked block for real, the caller holds the arena lock
+ *
+ * @return  the number of blocks freed
+ */
+int Quick_Flush(MEM_ARENA *arena) {
+    BLOCK_HEADER *block;
+    int count = arena->quick_count;
+
+    for (int cls = 0; arena->quick_count != 0 && cls < QUICK_CLASSES; cls++) {
+        while ((block = Arena_At(arena, arena->quick[cls])) != NULL) {
+            arena->quick[cls] = *(unsigned *)Get_User_Pointer(block);
+            arena->quick_count--;
+            __atomic_fetch_and(&block->size, ~REMOTE_BIT, __ATOMIC_RELAXED);
+            Heap_Free(block);
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Frees a block of the heap, parking it in deferred mode, the caller holds the arena lock
+ *
+ * @param block allocated block that is not a slab
+ */
+void Heap_Release(MEM_ARENA *arena, BLOCK_HEADER *block) {
+    int size = Get_Block_Size(block);
+
+    if (arena->quick_limit == 0 || size > QUICK_MAX_SIZE) {
+        Heap_Free(block);
+        return;
+    }
+
+    __atomic_fetch_or(&block->size, REMOTE_BIT, __ATOMIC_RELAXED);
+    *(unsigned *)Get_User_Pointer(block) = arena->quick[size / GRANULE - 1];
+    arena->quick[size / GRANULE - 1] = Arena_Offset(arena, block);
+    if (++arena->quick_count >= arena->quick_limit) Quick_Flush(arena);
+}
+
+/**
+ * @brief Takes a parked block of exactly the padded size back, the caller holds the arena lock
+ *
+ * @param size  size requested by the user
+ * @return      the user writeable address, NULL if no block of that size is parked
+ */
+void *Quick_Take(MEM_ARENA *arena, int size) {
+    int resize = Pad_Size(size);
+    BLOCK_HEADER *block;
+
+    if (arena->quick_count == 0 || resize > QUICK_MAX_SIZE) return NULL;
+    if ((block = Arena_At(arena, arena->quick[resize / GRANULE - 1])) == NULL) return NULL;
+
+    arena->quick[resize / GRANULE - 1] = *(unsigned *)Get_User_Pointer(block);
+    arena->quick_count--;
+    Stats_Used(block, -1);
+    __atomic_fetch_and(&block->size, ~REMOTE_BIT, __ATOMIC_RELAXED);
+    Set_Size(block, size);
+    Stats_Used(block, 1);
+    return Get_User_Pointer(block);
+}
+
+/**
+ * @brief Turns deferred coalescing on or off for an arena
+ *
+ * With a limit, Mem_Free parks blocks of up to QUICK_MAX_SIZE bytes for
+ * allocations of the same size and coalesces them in bulk once 'limit' of
+ * them are parked or the heap runs out of room.  Turning it off coalesces
+ * the parked blocks right away.
+ *
+ * @param arena arena to change
+ * @param limit parked blocks that trigger coalescing, 0 to coalesce on every free
+ * @return      0 on success, -1 on a negative limit
+ */
+int Mem_Arena_Set_Deferred(MEM_ARENA *arena, int limit) {
+    if (arena == NULL || limit < 0) return -1;
+
+    Arena_Lock(arena);
+    arena->quick_limit = limit;
+    if (arena->quick_count >= arena->quick_limit) Quick_Flush(arena);
+    pthread_mutex_unlock(&arena->lock);
+    return 0;
+}
+
+/**
+ * @brief Turns deferred coalescing on or off for the default arena, see Mem_Arena_Set_Deferred
+ */
+int Mem_Set_Deferred(int limit) { return Mem_Arena_Set_Deferred(default_arena, limit); }
+
+// #################################################################################
+// ###############                Heap Profiler                 ####################
+// #################################################################################
+
+/**
+ ** The heap profiler samples allocations of every arena of the process.
+ ** Each thread counts down the bytes it allocates, and the allocation that
+ ** takes the count to zero is sampled: its backtrace is taken and the block
+ ** is remembered until it is freed.  The distance to the next sample is
+ ** drawn from an exponential distribution with a mean of profile_rate
+ ** bytes, so a block of n bytes is sampled with a probability of
+ ** 1 - exp(-n / profile_rate) whatever the pattern of sizes.
+ **
+ ** Samples are grouped by backtrace.  Every PROFILE_STACK keeps what its
+ ** samples add up to, still live and ever allocated, and Mem_Profile_Dump
+ ** writes them in the heap_v2 text format that pprof reads and scales back
+ ** up to an estimate of the whole heap.
+ **
+ ** Everything lives in one anonymous mapping made the first time sampling
+ ** is turned on, the profiler never allocates from the heaps it watches.
+ ** With sampling off an allocation only loads profile_rate, and a free only
+ ** loads profile_live.  With it on, a free also loads the bucket its
+ ** address hashes to, and takes the profiler lock only when that bucket
+ ** holds a sample.
+ */
+#define PROFILE_DEPTH 32          // frames kept per backtrace
+#define PROFILE_STACKS 4096       // distinct backtraces, a power of two
+#define PROFILE_SAMPLES 65536     // live samples
+#define PROFILE_BUCKETS_LOG2 16
+#define PROFILE_BUCKETS (1 << PROFILE_BUCKETS_LOG2)
+
+typedef struct PROFILE_STACK {
+    unsigned long long hash;  // hash of the frames, 0 for an unused entry
+    int depth;                // frames of the backtrace
+    long long live_count;     // samples of this backtrace not freed yet
+    long long live_bytes;     // bytes requested for them
+    long long alloc_count;    // samples of this backtrace ever taken
+    long long alloc_bytes;    // bytes requested for them
+    void *frames[PROFILE_DEPTH];
+} PROFILE_STACK;
+
+typedef struct PROFILE_SAMPLE {
+    void *ptr;       // the sampled block
+    unsigned size;   // bytes requested for it
+    unsigned stack;  // its entry of the stack table
+    unsigned next;   // next sample of the same bucket, or next unused sample, 0 for none
+} PROFILE_SAMPLE;
+
+typedef struct PROFILE {
+    unsigned buckets[PROFILE_BUCKETS];  // first sample per address hash, 0 for none
+    unsigned unused;                    // first unused sample, 0 for none
+    unsigned samples_made;              // samples initialized so far, sample 0 is never used
+    unsigned stack_count;               // entries of the stack table in use
+    unsigned long long dropped;         // samples lost because a table was full
+    PROFILE_SAMPLE samples[PROFILE_SAMPLES];
+    PROFILE_STACK stacks[PROFILE_STACKS];
+} PROFILE;
+
+PROFILE *profile;   // tables of the profiler, NULL until sampling is first turned on
+int profile_rate;   // mean bytes between samples, 0 when sampling is off
+int profile_live;   // samples not freed yet
+pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;  // guards the profile tables
+
+__thread long long profile_countdown;  // bytes this thread allocates before the next sample
+__thread unsigned long long profile_random;  // state of this thread's random numbers
+__thread int profile_busy;  // this thread is taking a sample, whatever it allocates is not
+
+/**
+ * @brief Returns the bucket of the sample table an address belongs to
+ */
+unsigned Profile_Bucket(void *ptr) {
+    return ((uintptr_t)ptr >> GRANULE_LOG2) * 0x9e3779b97f4a7c15ULL >> (64 - PROFILE_BUCKETS_LOG2);
+}
+
+/**
+ * @brief Draws the bytes until the next sample of the calling thread
+ *
+ * -ln(u) is exponentially distributed for u uniform in (0, 1].  The
+ * logarithm comes from the exponent and mantissa of a double, which is
+ * close enough to spread the samples out without pulling in libm.
+ *
+ * @return  bytes to the next sample, at least 1
+ */
+long long Profile_Interval() {
+    unsigned long long x = profile_random;
+    unsigned long long bits;
+    double u;
+    double log2_u;
+
+    if (x == 0) x = (uintptr_t)&x ^ 0x2545f4914f6cdd1dULL;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    profile_random = x;
+
+    u = (double)((x >> 11) + 1) / (double)(1ULL << 53);
+    memcpy(&bits, &u, sizeof(bits));
+    log2_u = (double)((int)(bits >> 52) - 1023);
+    bits = (bits & ((1ULL << 52) - 1)) | (1023ULL << 52);
+    memcpy(&u, &bits, sizeof(u));
+    log2_u += u - 1;
+    return (long long)(-log2_u * 0.6931471805599453 * profile_rate) + 1;
+}
+
+/**
+ * @brief Finds the stack table entry of a backtrace, adding it if it is new
+ *
+ * The caller holds the profiler lock.
+ *
+ * @return  the entry, -1 if the table is full
+ */
+int Profile_Stack(void **frames, int depth) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    unsigned i;
+    int j;
+
+    for (j = 0; j < depth; j++) hash = (hash ^ (uintptr_t)frames[j]) * 0x100000001b3ULL;
+    if (hash == 0) hash = 1;
+
+    for (i = hash & (PROFILE_STACKS - 1);; i = (i + 1) & (PROFILE_STACKS - 1)) {
+        PROFILE_STACK *stack = &profile->stacks[i];
+
+        if (stack->hash == hash && stack->depth == depth &&
+            memcmp(stack->frames, frames, depth * sizeof(void *)) == 0)
+            return i;
+        if (stack->hash == 0) break;
+    }
+
+    // The table stays at most three quarters full so the probes stay short
+    if (profile->stack_count >= PROFILE_STACKS / 4 * 3) return -1;
+    profile->stack_count++;
+    profile->stacks[i].hash = hash;
+    profile->stacks[i].depth = depth;
+    memcpy(profile->stacks[i].frames, frames, depth * sizeof(void *));
+    return i;
+}
+
+/**
+ * @brief Takes the backtrace of an allocation and remembers the block until it is freed
+ *
+ * The first backtrace of the calling thread's countdown only arms it, so a
+ * thread that starts allocating is not sampled on its first byte.
+ */
+void Profile_Sample(void *ptr, int size) {
+    void *frames[PROFILE_DEPTH + 1];
+    PROFILE_SAMPLE *sample;
+    int armed = profile_random != 0;
+    int depth;
+    int stack;
+    unsigned index;
+    unsigned bucket;
+
+    profile_countdown = Profile_Interval();
+    if (!armed || profile_busy) return;
+
+    // The first frame is this function, the rest starts in the allocator
+    profile_busy = 1;
+    depth = backtrace(frames, PROFILE_DEPTH + 1) - 1;
+    profile_busy = 0;
+    if (depth < 0) return;
+
+    pthread_mutex_lock(&profile_lock);
+    if ((index = profile->unused) != 0) {
+        profile->unused = profile->samples[index].next;
+    } else if (profile->samples_made + 1 < PROFILE_SAMPLES) {
+        index = ++profile->samples_made;
+    }
+    if (index == 0 || (stack = Profile_Stack(frames + 1, depth)) < 0) {
+        if (index != 0) {
+            profile->samples[index].next = profile->unused;
+            profile->unused = index;
+        }
+        profile->dropped++;
+        pthread_mutex_unlock(&profile_lock);
+        return;
+    }
+
+    sample = &profile->samples[index];
+    sample->ptr = ptr;
+    sample->size = size;
+    sample->stack = stack;
+    profile->stacks[stack].live_count++;
+    profile->stacks[stack].live_bytes += size;
+    profile->stacks[stack].alloc_count++;
+    profile->stacks[stack].alloc_bytes += size;
+
+    bucket = Profile_Bucket(ptr);
+    sample->next = profile->buckets[bucket];
+    __atomic_store_n(&profile->buckets[bucket], index, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile_live, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/**
+ * @brief Counts an allocation towards the next sample, see Heap Profiler
+ *
+ * @param ptr   the block allocated, NULL if the allocation failed
+ * @param size  bytes requested
+ * @return      ptr
+ */
+void *Profile_Alloc(void *ptr, int size) {
+    if (__atomic_load_n(&profile_rate, __ATOMIC_RELAXED) != 0 && ptr != NULL &&
+        (profile_countdown -= size) <= 0)
+        Profile_Sample(ptr, size);
+    return ptr;
+}
+
+/**
+ * @brief Finds the link to the sample of a block, the caller holds the profiler lock
+ *
+ * @return  the bucket head or sample link that points to the sample, NULL if ptr has none
+ */
+unsigned *Profile_Link(void *ptr) {
+    unsigned *link = &profile->buckets[Profile_Bucket(ptr)];
+
+    for (; *link != 0; link = &profile->samples[*link].next)
+        if (profile->samples[*link].ptr == ptr) return link;
+    return NULL;
+}
+
+/**
+ * @brief Forgets the sample of a block that is being freed, the caller holds the profiler lock
+ */
+void Profile_Forget(void *ptr) {
+    unsigned *link = Profile_Link(ptr);
+    PROFILE_SAMPLE *sample;
+
+    if (link == NULL) return;
+    sample = &profile->samples[*link];
+    profile->stacks[sample->stack].live_count--;
+    profile->stacks[sample->stack].live_bytes -= sample->size;
+    sample->ptr = NULL;
+    __atomic_store_n(link, sample->next, __ATOMIC_RELAXED);
+    sample->next = profile->unused;
+    profile->unused = sample - profile->samples;
+    __atomic_fetch_sub(&profile_live, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Checks without locking if a block may have a sample
+ */
+int Profile_Maybe(void *ptr) {
+    return __atomic_load_n(&profile_live, __ATOMIC_RELAXED) != 0 &&
+           __atomic_load_n(&profile->buckets[Profile_Bucket(ptr)], __ATOMIC_RELAXED) != 0;
+}
+
+/**
+ * @brief Drops the sample of a block about to be freed, if it has one
+ */
+void Profile_Free(void *ptr) {
+    if (!Profile_Maybe(ptr)) return;
+
+    pthread_mutex_lock(&profile_lock);
+    Profile_Forget(ptr);
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/**
+ * @brief Moves the sample of a block that compaction moved, if it has one
+ */
+void Profile_Move(void *from, void *to) {
+    unsigned *link;
+    unsigned index;
+    unsigned bucket;
+
+    if (!Profile_Maybe(from)) return;
+
+    pthread_mutex_lock(&profile_lock);
+    if ((link = Profile_Link(from)) != NULL) {
+        index = *link;
+        __atomic_store_n(link, profile->samples[index].next, __ATOMIC_RELAXED);
+        profile->samples[index].ptr = to;
+        bucket = Profile_Bucket(to);
+        profile->samples[index].next = profile->buckets[bucket];
+        __atomic_store_n(&profile->buckets[bucket], index, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/**
+ * @brief Updates the sample of a block resized in place, if it has one
+ *
+ * @param ptr   the block, which kept its address
+ * @param size  bytes requested for it now
+ */
+void Profile_Resize(void *ptr, int size) {
+    unsigned *link;
+    PROFILE_SAMPLE *sample;
+
+    if (!Profile_Maybe(ptr)) return;
+
+    pthread_mutex_lock(&profile_lock);
+    if ((link = Profile_Link(ptr)) != NULL) {
+        sample = &profile->samples[*link];
+        profile->stacks[sample->stack].live_bytes += (long long)size - sample->size;
+        sample->size = size;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/**
+ * @brief Drops the samples of the heap of an arena that is being destroyed
+ *
+ * Large blocks lie outside the window, Mem_Arena_Destroy drops those one by one.
+ */
+void Profile_Drop_Arena(MEM_ARENA *arena) {
+    unsigned i;
+
+    if (__atomic_load_n(&profile_live, __ATOMIC_RELAXED) == 0) return;
+
+    pthread_mutex_lock(&profile_lock);
+    for (i = 1; i <= profile->samples_made; i++)
+        if (profile->samples[i].ptr != NULL && Arena_Of(profile->samples[i].ptr) == arena)
+            Profile_Forget(profile->samples[i].ptr);
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/**
+ ** Function for turning the heap profiler on or off.
+ *
+ *     One allocation is sampled for about every 'rate' bytes allocated, in
+ *     every arena of the process.  Turning sampling off keeps the samples
+ *     taken so far, they are still dropped as their blocks are freed and
+ *     show up in Mem_Profile_Dump again once sampling is turned back on.
+ *
+ * @param   rate    mean bytes between samples, 0 to stop sampling
+ * @return  :   0 on success
+ *              -1 if rate is negative or the profiler tables cannot be mapped
+ */
+int Mem_Set_Profile_Rate(int rate) {
+    void *frame;
+    void *tables;
+
+    if (rate < 0) return -1;
+
+    pthread_mutex_lock(&profile_lock);
+    if (rate != 0 && profile == NULL) {
+        tables = mmap(NULL, sizeof(PROFILE), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (tables == MAP_FAILED) {
+            pthread_mutex_unlock(&profile_lock);
+            return -1;
+        }
+        profile = tables;
+
+        // The first backtrace loads the unwinder, which allocates, so it is taken here
+        backtrace(&frame, 1);
+    }
+    __atomic_store_n(&profile_rate, rate, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&profile_lock);
+    return 0;
+}
+
+/**
+ ** Function for writing the samples of the heap profiler to a file.
+ *
+ *     The profile is in the heap_v2 text format, one line per backtrace
+ *     with the sampled blocks still live and those ever allocated, followed
+ *     by the memory map of the process so pprof can find the symbols:
+ *
+ *         pprof --text program profile
+ *
+ *     The backtraces start inside the allocator.  Nothing is allocated, so
+ *     this can be called from anywhere, an exit handler included.
+ *
+ * @param   fd  file descriptor to write to
+ * @return  :   0 on success
+ *              -1 if sampling is off, nothing is written then
+ *              -1 if writing failed
+ */
+int Mem_Profile_Dump(int fd) {
+    long long totals[4] = {0, 0, 0, 0};
+    char line[64 + PROFILE_DEPTH * 20];
+    char buffer[4096];
+    ssize_t n;
+    int length;
+    int maps;
+    int result = 0;
+    int i;
+    int j;
+
+    // Lines are formatted on the stack, stdio streams allocate their buffers
+    pthread_mutex_lock(&profile_lock);
+    if (profile_rate == 0) {
+        pthread_mutex_unlock(&profile_lock);
+        return -1;
+    }
+    for (i = 0; i < PROFILE_STACKS; i++) {
+        totals[0] += profile->stacks[i].live_count;
+        totals[1] += profile->stacks[i].live_bytes;
+        totals[2] += profile->stacks[i].alloc_count;
+        totals[3] += profile->stacks[i].alloc_bytes;
+    }
+    length = snprintf(line, sizeof(line), "heap profile: %lld: %lld [%lld: %lld] @ heap_v2/%d\n",
+                      totals[0], totals[1], totals[2], totals[3], profile_rate);
+    if (write(fd, line, length) != length) result = -1;
+
+    for (i = 0; i < PROFILE_STACKS; i++) {
+        PROFILE_STACK *stack = &profile->stacks[i];
+
+        if (stack->hash == 0) continue;
+        length = snprintf(line, sizeof(line), "%lld: %lld [%lld: %lld] @", stack->live_count,
+                          stack->live_bytes, stack->alloc_count, stack->alloc_bytes);
+        for (j = 0; j < stack->depth; j++)
+            length += snprintf(line + length, sizeof(line) - length, " %p", stack->frames[j]);
+        line[length++] = '\n';
+        if (write(fd, line, length) != length) result = -1;
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    if (write(fd, "\nMAPPED_LIBRARIES:\n", 19) != 19) result = -1;
+    if ((maps = open("/proc/self/maps", O_RDONLY)) >= 0) {
+        while ((n = read(maps, buffer, sizeof(buffer))) > 0)
+            if (write(fd, buffer, n) != n) result = -1;
+        close(maps);
+    }
+    return result;
+}
+
+// #################################################################################
+// ###############              Allocate Memory                 ####################
+// #################################################################################
+
+/**
+ * @brief Grows the heap of an arena by at least enough to fit a 'size' byte block
+ *
+ * The caller holds the arena lock.  The heap at least doubles, so an arena
+ * that keeps growing only does so a few times.
+ *
+ * @param size  padded payload size that did not fit
+ * @return      0 if the heap grew, or parked blocks coalesced into a fitting block,
+ *              -1 if it is at max_size or mmap failed
+ */
+int Heap_Grow(MEM_ARENA *arena, int size) {
+    BLOCK_HEADER *old_last;
+    BLOCK_HEADER *new_last;
+    unsigned grow;
+    unsigned bitmap_size;
+
+    // Coalescing what is parked is cheaper than growing, and may be all it takes
+    if (Quick_Flush(arena) != 0 && Get_Next_Free(arena, size) != NULL) return 0;
+    old_last = Last_Header(arena);
+
+    // Room for the block and a new end of heap header, plus what the TLSF search rounds up
+    grow = size + sizeof(BLOCK_HEADER) + size / SL_INDEX_COUNT;
+    if (grow < arena->size) grow = arena->size;
+    grow = Pad_Unit(grow, arena->map_unit);
+    if (grow > arena->max_size - arena->size)
+        grow = (arena->max_size - arena->size) / arena->map_unit * arena->map_unit;
+    if (grow == 0) return -1;
+
+    bitmap_size = Pad_Page(((arena->size + grow) / GRANULE + 31) / 32 * sizeof(unsigned));
+    if (arena->file) {
+        // The window maps the whole file already, the file only has to get longer
+        int fd = Arena_File(arena);
+
+        if (bitmap_size > arena->bitmap_size) {
+            if (File_Extend(fd, arena->bitmap + arena->bitmap_size,
+                            bitmap_size - arena->bitmap_size) != 0)
+                return -1;
+            arena->bitmap_size = bitmap_size;
+        }
+        if (File_Extend(fd, arena->first + arena->size, grow) != 0) return -1;
+    } else {
+        if (bitmap_size > arena->bitmap_size) {
+            if (Map_Heap(Arena_At(arena, arena->bitmap + arena->bitmap_size),
+                         bitmap_size - arena->bitmap_size, Bitmap_Map_Flags(arena->map_flags)) != 0)
+                return -1;
+            arena->bitmap_size = bitmap_size;
+        }
+        if (Map_Heap(Arena_At(arena, arena->first + arena->size), grow, arena->map_flags) != 0)
+            return -1;
+    }
+    arena->size += grow;
+    __atomic_store_n(&arena->last, arena->last + grow, __ATOMIC_RELAXED);
+
+    new_last = Last_Header(arena);
+    Init_Header(new_last);
+    Mark_Header(new_last);
+
+    // The old end of heap header becomes an allocated block over the new memory,
+    // freeing it coalesces it with a free block above and puts it in the index
+    Set_Next_Pointer(old_last, new_last);
+    Set_Allocated(old_last);
+    Stats_Used(old_last, 1);
+    Heap_Free(old_last);
+    return 0;
+}
+
+/**
+ * @brief Allocates the front of a free block, the caller holds the arena lock
+ *
+ * The block must already be out of the index.  The rest of it is split off
+ * as a new free block when it is big enough.
+ *
+ * @param   free    free block with at least Pad_Size(size) bytes of payload
+ * @param   size    How much free space needed
+ * @return  the user writeable address of allocated block
+ */
+void *Heap_Take(MEM_ARENA *arena, BLOCK_HEADER *free, int size) {
+    int resize = Pad_Size(size);
+
+    // If there is only size of header left, no split
+    if ((int)(free->size - sizeof(BLOCK_HEADER) - resize) < 4) {
+        Set_Allocated(free);
+        Set_Size(free, size);
+        Stats_Used(free, 1);
+        Clear_Prev_Free(Get_Next_Header(free));
+        arena->rover = Arena_Offset(arena, Get_Next_Header(free));
         // return what the user can use
         return Get_User_Pointer(free);
     }
 
-    // Otherwise, we need to split and get a new head
-    // Header for splitting the block
-    BLOCK_HEADER *next;
-    next = Get_User_Pointer(free) + resize;
-
-    // printf("Split at: %p\n", next);
+    // Otherwise, we need to split and get a new head
+    // Header for splitting the block
+    BLOCK_HEADER *next;
+    next = (BLOCK_HEADER *)((unsigned char *)Get_User_Pointer(free) + resize);
+
+    // Update the pointers, the new header starts out with no flags since the block above is taken
+    Init_Header(next);
+    Set_Next_Pointer(next, Get_Next_Header(free));
+    Set_Next_Pointer(free, next);
+
+    // Update split header, the block below still has a free block above it
+    Mark_Header(next);
+    Set_Size(next, Get_Block_Size(next));
+    Set_Footer(next);
+    Index_Insert(next);
+
+    // Update old header
+    Set_Size(free, size);
+    Set_Allocated(free);
+    Stats_Used(free, 1);
+
+    // Next fit picks up from the leftover piece
+    arena->rover = Arena_Offset(arena, next);
+    return Get_User_Pointer(free);
+}
+
+/**
+ ** Allocates 'size' bytes from the heap of an arena, the caller holds the arena lock.
+ *
+ *     Check for sanity of size - Return NULL when appropriate - at least 1 byte. 
+ *     Traverse the list of blocks and locate a free block which can accommodate
+ *              the requested size based on the policy (e.g. first fit, best fit). 
+ * TODO:    The next header must be aligned with an address divisible by 4. 
+ *              Add padding to accomodate this requirement. 
+ * TODO:    When allocating a block - split it into two blocks when possible. 
+ *          ? the allocated block should go first and the free block second. 
+ *          ? the free block must have a minimum payload size of 4 bytes.  
+ *          ? do not split if the mininmum payload size can not be reserved. 
+ * 
+ * @param   size    How much free space needed
+ * @return  :   the user writeable address of allocated block 
+ *                  ! this is the first byte of the payload, not the address of the header
+ *              NULL on failure
+ */
+void *Heap_Alloc(MEM_ARENA *arena, int size) {
+    // Checks size is 1 or larger
+    if (size < 1) return NULL;
+
+    BLOCK_HEADER *free;
+
+    // Gets size with padding to %4
+    int resize = Pad_Size(size);
+
+    // A parked block of the same size needs no search at all
+    if ((free = Quick_Take(arena, size)) != NULL) return free;
+
+    // Find a suitable block, growing the heap if there is none
+    if ((free = Get_Next_Free(arena, resize)) == NULL) {
+        if (Heap_Grow(arena, resize) != 0 || (free = Get_Next_Free(arena, resize)) == NULL)
+            return NULL;
+    }
+    Index_Remove(free);
+    return Heap_Take(arena, free, size);
+}
+
+/**
+ * @brief Allocates 'size' bytes at an address divisible by 'alignment'
+ *
+ * The caller holds the arena lock.  The free block is searched with room for
+ * the worst case slack, the slack in front of the aligned payload is split
+ * off as a free block of its own.
+ *
+ * @param   size        How much free space needed
+ * @param   alignment   power of two, at least GRANULE
+ * @return  the user writeable address of allocated block, NULL on failure
+ */
+void *Heap_Alloc_Aligned(MEM_ARENA *arena, int size, int alignment) {
+    BLOCK_HEADER *free;
+    BLOCK_HEADER *block;
+    uintptr_t payload;
+    int search;
+
+    if (size < 1) return NULL;
+
+    // The smallest slack that can be split off is a header with a GRANULE of payload
+    search = Pad_Size(size) + alignment + sizeof(BLOCK_HEADER) + GRANULE;
+    if ((free = Get_Next_Free(arena, search)) == NULL) {
+        if (Heap_Grow(arena, search) != 0 || (free = Get_Next_Free(arena, search)) == NULL)
+            return NULL;
+    }
+    Index_Remove(free);
+
+    payload = ((uintptr_t)Get_User_Pointer(free) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (payload != (uintptr_t)Get_User_Pointer(free)) {
+        if (payload - (uintptr_t)Get_User_Pointer(free) < sizeof(BLOCK_HEADER) + GRANULE)
+            payload += alignment;
+
+        // The aligned block starts out free with the slack above it
+        block = Get_Header_From_User_Pointer((void *)payload);
+        Init_Header(block);
+        Set_Next_Pointer(block, Get_Next_Header(free));
+        Set_Next_Pointer(free, block);
+        Mark_Header(block);
+        Set_Prev_Free(block);
+        Set_Size(block, Get_Block_Size(block));
+
+        Set_Size(free, Get_Block_Size(free));
+        Set_Footer(free);
+        Index_Insert(free);
+        free = block;
+    }
+    return Heap_Take(arena, free, size);
+}
+
+/**
+ * @brief Allocates up to n blocks of 'size' bytes from the heap, the caller holds the arena lock
+ *
+ * One free block with room for all of them is searched for, and the blocks
+ * are carved from its front one after the other, the rest of it only goes
+ * back to the index once.  When there is no such block the batch is carved
+ * from as many free blocks as it takes.
+ *
+ * @param   size    How much free space needed per block
+ * @param   n       number of blocks wanted
+ * @param   out     receives the user writeable addresses of the blocks
+ * @return  the number of blocks allocated, less than n when the heap is full
+ */
+int Heap_Alloc_Batch(MEM_ARENA *arena, int size, int n, void **out) {
+    int resize = Pad_Size(size);
+    int count = 0;
+    long long want;
+    BLOCK_HEADER *free;
+    BLOCK_HEADER *next;
+
+    while (count < n) {
+        want = (long long)(n - count) * (resize + sizeof(BLOCK_HEADER)) - sizeof(BLOCK_HEADER);
+        if (want > INT32_MAX / 2) want = INT32_MAX / 2;
+        if ((free = Get_Next_Free(arena, want)) == NULL &&
+            (free = Get_Next_Free(arena, resize)) == NULL) {
+            if (Heap_Grow(arena, want) != 0) break;
+            continue;
+        }
+        Index_Remove(free);
+
+        // Split off blocks while the rest still has room for another one
+        while (count < n - 1 && Get_Block_Size(free) >= 2 * resize + (int)sizeof(BLOCK_HEADER)) {
+            next = (BLOCK_HEADER *)((unsigned char *)Get_User_Pointer(free) + resize);
+            Init_Header(next);
+            Set_Next_Pointer(next, Get_Next_Header(free));
+            Set_Next_Pointer(free, next);
+            Mark_Header(next);
+            Set_Size(next, Get_Block_Size(next));
+
+            Set_Size(free, size);
+            Set_Allocated(free);
+            Stats_Used(free, 1);
+            out[count++] = Get_User_Pointer(free);
+            free = next;
+        }
+        out[count++] = Heap_Take(arena, free, size);
+    }
+    return count;
+}
+
+/**
+ ** Function for allocating 'size' bytes from an arena.
+ *
+ *     Small requests are served from the calling thread's cache without any
+ *     locking when it holds an object of the right size, or else from a slab;
+ *     requests of at least the mmap threshold get a mapping of their own;
+ *     everything else goes to the heap of the arena under its lock.
+ *
+ * @param   arena   arena to allocate from
+ * @param   size    How much free space needed
+ * @return  :   the user writeable address of allocated block
+ *              NULL on failure
+ */
+void *Mem_Arena_Alloc(MEM_ARENA *arena, int size) {
+    void *ptr;
+
+    if (arena == NULL || size < 1) return NULL;
+
+    if (Is_Large(arena, size))
+        return Profile_Alloc(Stats_Alloc(arena, Large_Alloc(arena, size, GRANULE)), size);
+
+    if (Pad_Size(size) <= SLAB_MAX_SIZE) {
+        if ((ptr = Cache_Pop(arena, Pad_Size(size))) != NULL) return Profile_Alloc(ptr, size);
+
+        // Small requests fall back to ordinary blocks when the heap has no room for a slab
+        Arena_Lock(arena);
+        if ((ptr = Slab_Alloc(arena, Pad_Size(size))) == NULL) ptr = Heap_Alloc(arena, size);
+        pthread_mutex_unlock(&arena->lock);
+        return Profile_Alloc(Stats_Alloc(arena, ptr), size);
+    }
+
+    Arena_Lock(arena);
+    ptr = Heap_Alloc(arena, size);
+    pthread_mutex_unlock(&arena->lock);
+    return Profile_Alloc(Stats_Alloc(arena, ptr), size);
+}
+
+/**
+ ** Function for allocating 'size' bytes from the default arena.
+ *
+ * @param   size    How much free space needed
+ * @return  :   the user writeable address of allocated block
+ *              NULL on failure
+ */
+void *Mem_Alloc(int size) { return Mem_Arena_Alloc(default_arena, size); }
+
+/**
+ ** Function for allocating 'size' bytes from an arena at an address divisible by 'alignment'.
+ *
+ *     Small requests with an alignment of up to SLAB_MAX_SIZE take an object of
+ *     the smallest power of two class that covers both, since slab objects of
+ *     those classes are aligned to their size.  Large requests with an
+ *     alignment of up to a page get a mapping of their own as usual.
+ *     Everything else is carved out of the heap, and the slack in front of
+ *     the aligned payload goes back to the heap as a free block.
+ *     The block is freed with Mem_Free / Mem_Arena_Free like any other.
+ *
+ * @param   arena       arena to allocate from
+ * @param   size        How much free space needed
+ * @param   alignment   power of two
+ * @return  :   the user writeable address of allocated block
+ *              NULL on failure or if alignment is not a power of two
+ */
+void *Mem_Arena_Alloc_Aligned(MEM_ARENA *arena, int size, int alignment) {
+    void *ptr = NULL;
+    int cls = 0;
+
+    if (arena == NULL || size < 1 || alignment < 1 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+    if (alignment <= GRANULE) return Mem_Arena_Alloc(arena, size);
+    if (size > INT32_MAX - alignment - 2 * (int)sizeof(BLOCK_HEADER) - GRANULE) return NULL;
+
+    if (Is_Large(arena, size) && alignment <= getpagesize())
+        return Profile_Alloc(Stats_Alloc(arena, Large_Alloc(arena, size, alignment)), size);
+
+    if (size <= SLAB_MAX_SIZE && alignment <= SLAB_MAX_SIZE) {
+        for (cls = alignment; cls < size; cls *= 2)
+            ;
+        if ((ptr = Cache_Pop(arena, cls)) != NULL) return Profile_Alloc(ptr, size);
+    }
+
+    Arena_Lock(arena);
+    if (cls != 0) ptr = Slab_Alloc(arena, cls);
+    if (ptr == NULL) ptr = Heap_Alloc_Aligned(arena, size, alignment);
+    pthread_mutex_unlock(&arena->lock);
+    return Profile_Alloc(Stats_Alloc(arena, ptr), size);
+}
+
+/**
+ ** Function for allocating 'size' bytes from the default arena at an aligned address.
+ *
+ * @param   size        How much free space needed
+ * @param   alignment   power of two
+ * @return  :   the user writeable address of allocated block
+ *              NULL on failure
+ */
+void *Mem_Alloc_Aligned(int size, int alignment) {
+    return Mem_Arena_Alloc_Aligned(default_arena, size, alignment);
+}
+
+/**
+ ** Function for allocating n blocks of 'size' bytes from an arena in one go.
+ *
+ *     Small objects are drained from the thread cache first, then taken from
+ *     slabs; blocks of the heap are carved side by side out of one free
+ *     block.  The arena lock is taken once for the whole batch.
+ *
+ * @param   arena   arena to allocate from
+ * @param   size    How much free space needed per block
+ * @param   n       number of blocks wanted
+ * @param   out     receives the user writeable addresses of the blocks
+ * @return  :   the number of blocks allocated, less than n when the arena runs out
+ *              -1 on bad arguments
+ */
+int Mem_Arena_Alloc_Batch(MEM_ARENA *arena, int size, int n, void **out) {
+    int count = 0;
+    int cached = 0;
+    int i;
+
+    if (arena == NULL || size < 1 || n < 0 || out == NULL) return -1;
+
+    if (Is_Large(arena, size)) {
+        while (count < n && (out[count] = Large_Alloc(arena, size, GRANULE)) != NULL) count++;
+    } else {
+        if (Pad_Size(size) <= SLAB_MAX_SIZE)
+            while (cached < n && (out[cached] = Cache_Pop(arena, Pad_Size(size))) != NULL) cached++;
+        count = cached;
+
+        Arena_Lock(arena);
+        if (Pad_Size(size) <= SLAB_MAX_SIZE)
+            while (count < n && (out[count] = Slab_Alloc(arena, Pad_Size(size))) != NULL) count++;
+        count += Heap_Alloc_Batch(arena, size, n - count, out + count);
+        pthread_mutex_unlock(&arena->lock);
+    }
+
+    // Objects from the thread cache are counted by the cache
+    Stats_Count(&arena->alloc_count, count - cached);
+    Stats_Count(&arena->failed_allocs, n - count);
+    for (i = 0; i < count; i++) Profile_Alloc(out[i], size);
+    return count;
+}
+
+/**
+ ** Function for allocating n blocks of 'size' bytes from the default arena in one go.
+ *
+ * @param   size    How much free space needed per block
+ * @param   n       number of blocks wanted
+ * @param   out     receives the user writeable addresses of the blocks
+ * @return  :   the number of blocks allocated, -1 on bad arguments
+ */
+int Mem_Alloc_Batch(int size, int n, void **out) {
+    return Mem_Arena_Alloc_Batch(default_arena, size, n, out);
+}
+
+// #################################################################################
+// ###############              Free up Memory                  ####################
+// #################################################################################
+
+/**
+ ** Returns a block to the heap of its arena, the caller holds the arena lock
+ *
+ *     Marks the block as free and coalesces it with free neighbours.
+ *
+ *  @param free :   header of a valid allocated block
+ */
+void Heap_Free(BLOCK_HEADER *free) {
+    // Free up current block, the whole space up to the next header is payload again
+    Stats_Used(free, -1);
+    Set_Free(free);
+    Set_Size(free, Get_Block_Size(free));
+
+    // Check if need to merge up, the footer of the block above leads right to it
+    if (Is_Prev_Free(free)) {
+        BLOCK_HEADER *above = Get_Prev_Header(free);
+        Index_Remove(above);
+        Merge_Next(above);
+        free = above;
+    }
+
+    // Check if need to merge down, the end of the list is never free to merge with
+    BLOCK_HEADER *below = Get_Next_Header(free);
+    if (Is_Free(below) && Get_Next_Header(below) != NULL) {
+        Index_Remove(below);
+        Merge_Next(free);
+    }
+
+    Set_Footer(free);
+    Set_Prev_Free(Get_Next_Header(free));
+    Index_Insert(free);
+}
+
+/**
+ ** Function for freeing up a previously allocated block of an arena
+ *     Small objects are parked in the calling thread's cache without locking,
+ *     large blocks are unmapped, everything else is coalesced back into the
+ *     heap under the arena lock.
+ *
+ *  @param arena:   arena the block was allocated from
+ *  @param ptr  :   Address of the block to be freed up i, this is the first address of the payload
+ *  @return     :   0 on success
+ *                  -1 if ptr is NULL
+ *                  -1 if ptr is not pointing to the first byte of an allocated block of the arena
+ *                ? the header bitmap tells if a header starts there, then the alloc bit is checked
+ */
+int Mem_Arena_Free(MEM_ARENA *arena, void *ptr) {
+    // Check valid input
+    if (arena == NULL || ptr == NULL) return -1;
+
+    // Each branch drops the sample once the block is known to be live and claimed, and
+    // before it can be handed out again.  Blocks of the heap all lie inside the arena window, large blocks never do.  They cannot
+    // be claimed without looking them up, so they have a lock of their own instead of the
+    // remote free list and never wait for the heap
+    if (Arena_Of(ptr) != arena) {
+        LARGE_HEADER *large;
+
+        pthread_mutex_lock(&arena->large_lock);
+        if ((large = Large_Header(arena, ptr)) != NULL) {
+            Profile_Free(ptr);
+            Large_Free(large);
+        }
+        pthread_mutex_unlock(&arena->large_lock);
+        if (large == NULL) return -1;
+        Stats_Count(&arena->free_count, 1);
+        return 0;
+    }
+
+    BLOCK_HEADER *free = Get_Header_From_User_Pointer(ptr);
+
+    // Small objects have no header, the slab they are in keeps track of them
+    if (Valid_Block(arena, free) == 0) {
+        if (Slab_Set_Cached(arena, ptr) != 0) return -1;
+        Profile_Free(ptr);
+        if (!arena->file) {
+            Cache_Push(ptr);
+            return 0;
+        }
+
+        // A cached object of a heap file would stay in use once the file is closed
+        if (pthread_mutex_trylock(&arena->lock) != 0) {
+            Remote_Push(arena, ptr);
+        } else {
+            Remote_Drain(arena);
+            Slab_Free(ptr);
+            pthread_mutex_unlock(&arena->lock);
+        }
+        Stats_Count(&arena->free_count, 1);
+        return 0;
+    }
+
+    // The payload of a slab itself was never handed out
+    if (Is_Free(free) || Is_Slab(free) || Is_Remote(free)) {
+        return -1;
+    }
+
+    // Waiting for the lock is left to whoever holds it, the block goes on the remote free list
+    if (pthread_mutex_trylock(&arena->lock) != 0) {
+        if (__atomic_fetch_or(&free->size, REMOTE_BIT, __ATOMIC_RELAXED) & REMOTE_BIT) return -1;
+        Profile_Free(ptr);
+        Remote_Push(arena, ptr);
+    } else {
+        Remote_Drain(arena);
+        Profile_Free(ptr);
+        Heap_Release(arena, free);
+        pthread_mutex_unlock(&arena->lock);
+    }
+    Stats_Count(&arena->free_count, 1);
+    return 0;
+}
+
+/**
+ ** Function for freeing up a previously allocated block of the default arena
+ *
+ *  @param ptr  :   Address of the block to be freed up i, this is the first address of the payload
+ *  @return     :   0 on success, -1 if ptr is not a block allocated by Mem_Alloc
+ */
+int Mem_Free(void *ptr) { return Mem_Arena_Free(default_arena, ptr); }
+
+/**
+ * Orders user pointers by address for qsort
+ */
+int Address_Compare(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) * (void *const *)a;
+    uintptr_t y = (uintptr_t) * (void *const *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ ** Function for freeing up a batch of previously allocated blocks of an arena
+ *
+ *     Slab objects and large blocks are freed one by one as usual.  Blocks of
+ *     the heap are sorted by address, each run of blocks that lie right next
+ *     to each other is joined into one block and the run is coalesced with
+ *     its free neighbours once, all under a single lock.
+ *
+ *  @param arena:   arena the blocks were allocated from
+ *  @param ptrs :   addresses of the blocks, the array is reordered
+ *  @param n    :   number of addresses
+ *  @return     :   0 on success
+ *                  -1 if any address is not an allocated block of the arena, the others are
+ *                  still freed
+ */
+int Mem_Arena_Free_Batch(MEM_ARENA *arena, void **ptrs, int n) {
+    BLOCK_HEADER *block;
+    BLOCK_HEADER *next;
+    void *tmp;
+    int heap = 0;
+    int freed = 0;
+    int result = 0;
+    int i;
+
+    if (arena == NULL || ptrs == NULL || n < 0) return -1;
+
+    // Move the blocks of the heap to the front, free everything else right away
+    for (i = 0; i < n; i++) {
+        if (ptrs[i] != NULL && Arena_Of(ptrs[i]) == arena &&
+            Valid_Block(arena, Get_Header_From_User_Pointer(ptrs[i]))) {
+            tmp = ptrs[heap];
+            ptrs[heap++] = ptrs[i];
+            ptrs[i] = tmp;
+        } else if (Mem_Arena_Free(arena, ptrs[i]) != 0) {
+            result = -1;
+        }
+    }
+    qsort(ptrs, heap, sizeof(void *), Address_Compare);
+
+    Arena_Lock(arena);
+    for (i = 0; i < heap; i++) {
+        // A block may have been freed since, or appear twice in the batch
+        block = Get_Header_From_User_Pointer(ptrs[i]);
+        if (!Valid_Block(arena, block) || Is_Free(block) || Is_Slab(block) || Is_Remote(block)) {
+            result = -1;
+            continue;
+        }
+        Profile_Free(ptrs[i]);
+
+        // Take in the blocks of the batch that follow it directly
+        while (i + 1 < heap && (next = Get_Header_From_User_Pointer(ptrs[i + 1])) ==
+                                   Get_Next_Header(block) &&
+               Is_Allocated(next) && !Is_Slab(next) && !Is_Remote(next)) {
+            Profile_Free(ptrs[i + 1]);
+            Stats_Used(block, -1);
+            Stats_Used(next, -1);
+            Merge_Next(block);
+            Stats_Used(block, 1);
+            freed++;
+            i++;
+        }
+        Heap_Free(block);
+        freed++;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    Stats_Count(&arena->free_count, freed);
+    return result;
+}
+
+/**
+ ** Function for freeing up a batch of previously allocated blocks of the default arena
+ *
+ *  @param ptrs :   addresses of the blocks, the array is reordered
+ *  @param n    :   number of addresses
+ *  @return     :   0 on success, -1 if any address is not a block allocated by Mem_Alloc
+ */
+int Mem_Free_Batch(void **ptrs, int n) { return Mem_Arena_Free_Batch(default_arena, ptrs, n); }
+
+/**
+ * @brief Unmaps an arena and everything allocated from it
+ *
+ * No other thread may be using the arena.  Objects of the arena still sitting
+ * in thread caches are dropped the next time those caches are flushed.
+ * The objects of a heap file stay in the file, which is written back,
+ * marked clean and closed.  A shared memory arena is only detached from,
+ * for the other processes it stays as it is.
+ *
+ * @param arena     arena from Mem_Arena_Create, or the default arena
+ * @return          0 on success, -1 if arena is not a live arena
+ */
+int Mem_Arena_Destroy(MEM_ARENA *arena) {
+    int slot;
+    int fd;
+
+    if (arena == NULL) return -1;
+
+    pthread_mutex_lock(&arena_list_lock);
+    for (slot = 0; slot < MAX_ARENAS && arena_list[slot] != arena; slot++)
+        ;
+    if (slot == MAX_ARENAS) {
+        pthread_mutex_unlock(&arena_list_lock);
+        return -1;
+    }
+    fd = arena_files[slot];
+    __atomic_store_n(&arena_list[slot], NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&arena_list_lock);
+
+    // The calling thread's own cached objects of the arena go away with it
+    if (Cache_Slot(arena)->arena == arena) Cache_Release(Cache_Slot(arena));
+    if (arena == default_arena) default_arena = NULL;
+
+    Profile_Drop_Arena(arena);
+    pthread_mutex_lock(&arena->large_lock);
+    while (arena->large != NULL) {
+        Profile_Free((unsigned char *)arena->large + arena->large->offset);
+        Large_Free(arena->large);
+    }
+    pthread_mutex_unlock(&arena->large_lock);
+
+    // Other processes still use a shared arena, its locks included
+    if (!arena->shared) {
+        pthread_mutex_destroy(&arena->lock);
+        pthread_mutex_destroy(&arena->large_lock);
+    }
+    if (arena->file && !arena->shared) {
+        // The heap has to be on disk before the file may count as clean
+        Remote_Drain(arena);
+        Quick_Flush(arena);
+        msync(arena, arena->first + arena->size, MS_SYNC);
+        arena->dirty = 0;
+        msync(arena, getpagesize(), MS_SYNC);
+    }
+    if (arena->file) close(fd);
+    munmap(arena, ARENA_WINDOW);
+    return 0;
+}
+
+/**
+ ** Function for taking every lock of the library before fork, see pthread_atfork.
+ *
+ *     A child gets a copy of the locks as they are at the fork, and only
+ *     the thread that forked.  A lock another thread held would stay taken
+ *     forever, so Mem_Fork_Prepare takes them all, in the order the library
+ *     always takes them, and Mem_Fork_Parent and Mem_Fork_Child let them
+ *     go on either side.  The child sets the locks of its own arenas up
+ *     afresh.  The locks of heap files live in the shared mapping, which the
+ *     parent unlocks for both.  Objects in the caches of the other threads
+ *     are lost to the child.
+ */
+void Mem_Fork_Prepare() {
+    pthread_mutex_lock(&arena_list_lock);
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        if (arena_list[i] == NULL) continue;
+        pthread_mutex_lock(&arena_list[i]->lock);
+        pthread_mutex_lock(&arena_list[i]->large_lock);
+    }
+    pthread_mutex_lock(&profile_lock);
+}
+
+/**
+ ** Function for letting go of the locks Mem_Fork_Prepare took, in the parent.
+ */
+void Mem_Fork_Parent() {
+    pthread_mutex_unlock(&profile_lock);
+    for (int i = MAX_ARENAS - 1; i >= 0; i--) {
+        if (arena_list[i] == NULL) continue;
+        pthread_mutex_unlock(&arena_list[i]->large_lock);
+        pthread_mutex_unlock(&arena_list[i]->lock);
+    }
+    pthread_mutex_unlock(&arena_list_lock);
+}
+
+/**
+ ** Function for setting the locks Mem_Fork_Prepare took up afresh, in the child.
+ */
+void Mem_Fork_Child() {
+    pthread_mutex_init(&profile_lock, NULL);
+    for (int i = 0; i < MAX_ARENAS; i++)
+        if (arena_list[i] != NULL && !arena_list[i]->file) Arena_Lock_Init(arena_list[i]);
+    pthread_mutex_init(&arena_list_lock, NULL);
+}
+
+// #################################################################################
+// ###############              Reallocate Memory               ####################
+// #################################################################################
+
+/**
+ * @brief Resizes an allocated block of the heap without moving it
+ *
+ * The caller holds the arena lock.  A block grows by absorbing the free
+ * block that physically follows it, and the heap is grown first when the
+ * block sits at its end.  The unused tail of the block is split off as a
+ * free block whenever it is big enough.
+ *
+ * @param block header of a valid allocated block that is not a slab
+ * @param size  new size requested by the user
+ * @return      0 if the block now holds 'size' bytes, -1 if it has to move
+ */
+int Heap_Resize(MEM_ARENA *arena, BLOCK_HEADER *block, int size) {
+    int resize = Pad_Size(size);
+    BLOCK_HEADER *next = Get_Next_Header(block);
+    BLOCK_HEADER *tail;
+
+    if (Get_Block_Size(block) < resize) {
+        // Only the end of heap header or a free block in front of it is left below
+        if (Get_Next_Header(next) == NULL ||
+            (Is_Free(next) && Get_Next_Header(Get_Next_Header(next)) == NULL))
+            Heap_Grow(arena, resize - Get_Block_Size(block));
+
+        next = Get_Next_Header(block);
+        if (Is_Free(next) == 0 || Get_Next_Header(next) == NULL ||
+            Get_Block_Size(block) + (int)sizeof(BLOCK_HEADER) + Get_Block_Size(next) < resize)
+            return -1;
+        Stats_Used(block, -1);
+        Index_Remove(next);
+        Merge_Next(block);
+        Clear_Prev_Free(Get_Next_Header(block));
+    } else {
+        Stats_Used(block, -1);
+    }
+    Set_Size(block, size);
+
+    // Same rule as a split on allocation, the tail must hold a header and 4 bytes
+    if (Get_Block_Size(block) - resize - (int)sizeof(BLOCK_HEADER) >= 4) {
+        tail = (BLOCK_HEADER *)((unsigned char *)Get_User_Pointer(block) + resize);
+        Init_Header(tail);
+        Set_Next_Pointer(tail, Get_Next_Header(block));
+        Set_Next_Pointer(block, tail);
+        Mark_Header(tail);
+
+        // Freeing the tail coalesces it with a free block below and puts it in the index
+        Set_Size(tail, 0);
+        Set_Allocated(tail);
+        Stats_Used(tail, 1);
+        Heap_Free(tail);
+    }
+    Stats_Used(block, 1);
+    return 0;
+}
+
+/**
+ ** Function for resizing a previously allocated block of an arena.
+ *
+ *     Blocks of the heap are resized in place when the free space behind
+ *     them allows it, slab objects stay put while the new size still fits
+ *     their class, and large blocks are remapped.  Only when none of that
+ *     works is a new block allocated, the contents copied and the old block
+ *     freed.
+ *
+ * @param   arena   arena the block was allocated from
+ * @param   ptr     block to resize, NULL to allocate a new one
+ * @param   size    new size, 0 to free the block
+ * @return  :   the user writeable address of the resized block, which may have moved
+ *              NULL on failure, the old block is left untouched
+ *              NULL if size is 0
+ */
+void *Mem_Arena_Realloc(MEM_ARENA *arena, void *ptr, int size) {
+    BLOCK_HEADER *block = Get_Header_From_User_Pointer(ptr);
+    LARGE_HEADER *large;
+    int old_size = -1;
+    int i;
+    void *moved;
+
+    if (arena == NULL || size < 0) return NULL;
+    if (ptr == NULL) return Mem_Arena_Alloc(arena, size);
+    if (size == 0) {
+        Mem_Arena_Free(arena, ptr);
+        return NULL;
+    }
+
+    if (Arena_Of(ptr) != arena) {
+        pthread_mutex_lock(&arena->large_lock);
+        if ((large = Large_Header(arena, ptr)) != NULL) {
+            if (Is_Large(arena, size) && (moved = Large_Resize(large, size)) != NULL) {
+                // The old address may be mapped again as soon as the lock is gone
+                if (moved != ptr) Profile_Free(ptr);
+                pthread_mutex_unlock(&arena->large_lock);
+
+                // A mapping that moved counts as a new block
+                if (moved != ptr) {
+                    Profile_Alloc(moved, size);
+                } else {
+                    Profile_Resize(ptr, size);
+                }
+                return moved;
+            }
+            old_size = large->size;
+        }
+        pthread_mutex_unlock(&arena->large_lock);
+    } else if (Valid_Block(arena, block)) {
+        if (Is_Free(block) || Is_Slab(block) || Is_Remote(block)) return NULL;
+        Arena_Lock(arena);
+        if (Heap_Resize(arena, block, size) == 0) {
+            pthread_mutex_unlock(&arena->lock);
+            Profile_Resize(ptr, size);
+            return ptr;
+        }
+        old_size = Get_Size(block);
+        pthread_mutex_unlock(&arena->lock);
+    } else if ((i = Slab_Index(arena, ptr)) >= 0 && Bit_Test(Slab_Of(ptr)->used, i) &&
+               !Bit_Test(Slab_Of(ptr)->cached, i)) {
+        if (Pad_Size(size) <= (int)Slab_Of(ptr)->size) {
+            Profile_Resize(ptr, size);
+            return ptr;
+        }
+        old_size = Slab_Of(ptr)->size;
+    }
+    if (old_size < 0) return NULL;
+
+    if ((moved = Mem_Arena_Alloc(arena, size)) == NULL) return NULL;
+    memcpy(moved, ptr, old_size < size ? old_size : size);
+    Mem_Arena_Free(arena, ptr);
+    return moved;
+}
 
-    // Update the pointers
-    Set_Next_Pointer(next, (BLOCK_HEADER *)free->packed_pointer);
-    // printf("Next is: %p\t points to: %p\n", next, next->packed_pointer);
-    Set_Next_Pointer(free, next);
-    // printf("Free is: %p\t points to: %p\n", free, free->packed_pointer);
+/**
+ ** Function for resizing a previously allocated block of the default arena.
+ *
+ * @param   ptr     block to resize, NULL to allocate a new one
+ * @param   size    new size, 0 to free the block
+ * @return  :   the user writeable address of the resized block, which may have moved
+ *              NULL on failure or if size is 0
+ */
+void *Mem_Realloc(void *ptr, int size) { return Mem_Arena_Realloc(default_arena, ptr, size); }
 
-    // Update split header
-    Set_Size(next, free->size - sizeof(BLOCK_HEADER) - resize);
+/**
+ ** Function for finding how many bytes of a block of an arena the user may write to.
+ *
+ *     That is at least the size it was allocated with: the padding of a
+ *     block of the heap, the whole object of a slab and the rest of the
+ *     last page of a large block can be used as well.
+ *
+ * @param   arena   arena the block was allocated from
+ * @param   ptr     an allocated block
+ * @return  :   the usable size of the block
+ *              -1 if ptr is not an allocated block of the arena
+ */
+int Mem_Arena_Usable_Size(MEM_ARENA *arena, void *ptr) {
+    BLOCK_HEADER *block = Get_Header_From_User_Pointer(ptr);
+    LARGE_HEADER *large;
+    int size = -1;
+    int i;
 
-    // Update old header
-    Set_Size(free, size);
-    Set_Allocated(free);
+    if (arena == NULL || ptr == NULL) return -1;
 
-    // printf("Returning: %p\n\n\n", Get_User_Pointer(free));
-    return Get_User_Pointer(free);
+    if (Arena_Of(ptr) != arena) {
+        pthread_mutex_lock(&arena->large_lock);
+        if ((large = Large_Header(arena, ptr)) != NULL) {
+            size_t usable = Large_Map_Size(large) - large->offset;
+            size = usable > INT32_MAX ? INT32_MAX : (int)usable;
+        }
+        pthread_mutex_unlock(&arena->large_lock);
+    } else if (Valid_Block(arena, block)) {
+        if (Is_Allocated(block) && !Is_Slab(block) && !Is_Remote(block))
+            size = Get_Block_Size(block);
+    } else if ((i = Slab_Index(arena, ptr)) >= 0 && Bit_Test(Slab_Of(ptr)->used, i) &&
+               !Bit_Test(Slab_Of(ptr)->cached, i)) {
+        size = Slab_Of(ptr)->size;
+    }
+    return size;
 }
 
+/**
+ ** Function for finding how many bytes of a block of the default arena the user may write to.
+ *
+ * @param   ptr     an allocated block
+ * @return  :   the usable size of the block, -1 if ptr is not a block allocated by Mem_Alloc
+ */
+int Mem_Usable_Size(void *ptr) { return Mem_Arena_Usable_Size(default_arena, ptr); }
+
 // #################################################################################
-// ###############              Free up Memory                  ####################
+// ###############                   Handles                    ####################
 // #################################################################################
 
 /**
- ** Function for freeing up a previously allocated block
- * TODO:    Mark the block as free
- * TODO:    Coalesce if one or both of the immediate neighbours are free
+ ** A handle names a block of the heap that Mem_Arena_Compact may move.  The
+ ** handle table is an ordinary block of the heap holding, per handle, the
+ ** offset of the block and how many Mem_Lock calls pin it in place.  The
+ ** block keeps its handle in its first GRANULE bytes, ahead of what the
+ ** user sees, so a walk over the block list can tell a block of a handle
+ ** from any other: the handle has to lead back to the same block.
+ **
+ ** Unused entries are chained through their lock counts.  Handle 0 is
+ ** never handed out, so the first word of the table itself, the block of
+ ** entry 0, reads as no handle.
+ */
+typedef struct HANDLE {
+    unsigned block;  // offset of the header of the block, 0 for an unused handle
+    unsigned locks;  // Mem_Lock calls not undone yet, the next unused handle for unused entries
+} HANDLE;
+
+#define HANDLE_TABLE_MIN 64
+
+HANDLE *Handle_Table(MEM_ARENA *arena) { return Arena_At(arena, arena->handles); }
+
+/**
+ * @brief Looks up the entry of a handle in use, the caller holds the arena lock
  *
- *  @param ptr  :   Address of the block to be freed up i, this is the first address of the payload
- *  @return     :   0 on success
- *                  -1 if ptr is NULL
- *                  -1 if ptr is not pointing to the first byte of an allocated block
- *                ? hint: check all block headers, determine if the alloc bit is set
+ * @return  the entry, NULL if the handle is not in use
  */
-int Mem_Free(void *ptr) {
-    ptr = Get_Header_From_User_Pointer(ptr);
+HANDLE *Handle_Entry(MEM_ARENA *arena, MEM_HANDLE handle) {
+    if (handle == 0 || handle >= arena->handle_count) return NULL;
+    return Handle_Table(arena)[handle].block ? &Handle_Table(arena)[handle] : NULL;
+}
 
-    BLOCK_HEADER *free = ptr;
+/**
+ * @brief Doubles the handle table, the caller holds the arena lock
+ *
+ * @return  0 on success, -1 if the heap has no room for the bigger table
+ */
+int Handle_Grow(MEM_ARENA *arena) {
+    unsigned count = arena->handle_count ? 2 * arena->handle_count : HANDLE_TABLE_MIN;
+    HANDLE *old = Handle_Table(arena);
+    HANDLE *table;
 
-    // printf("Freeing block: %p\n", free);
+    if (count > HEAP_MAX / 2 / sizeof(HANDLE)) return -1;
+    if ((table = Heap_Alloc(arena, count * sizeof(HANDLE))) == NULL) return -1;
+    memset(table, 0, count * sizeof(HANDLE));
+    if (old != NULL) {
+        memcpy(table, old, arena->handle_count * sizeof(HANDLE));
+        Heap_Free(Get_Header_From_User_Pointer(old));
+    }
 
-    // printf("Pointer is: %p\n", ptr);
-    if (Valid_Block(ptr) == 0) {
-        return -1;
+    // Chain the new entries so the lowest one is handed out first
+    for (unsigned i = count - 1; i >= arena->handle_count && i > 0; i--) {
+        table[i].locks = arena->handle_free;
+        arena->handle_free = i;
     }
-    // Check valid input
-    if (ptr == NULL || Is_Free(ptr)) return -1;
+    arena->handles = Arena_Offset(arena, table);
+    arena->handle_count = count;
+    return 0;
+}
 
+/**
+ * @brief Checks if compaction may move a block, the caller holds the arena lock
+ *
+ * @param block allocated block
+ * @return      1 for the handle table and for blocks of handles nobody pins, 0 otherwise
+ */
+int Handle_Movable(MEM_ARENA *arena, BLOCK_HEADER *block) {
+    unsigned handle;
 
-    // Free up current block
-    Set_Free(free);
-    Set_Size(free, Pad_Size(free->size));
-
-    // Get the block above
-    BLOCK_HEADER *curr = first_header;
-
-    // See if it's the top block
-    if (curr == free) {
-        if (Is_Free(free->packed_pointer)) {
-            // printf("\n\nAbout to coalesce the block BELOW\n");
-            BLOCK_HEADER *temp = free->packed_pointer;
-            // Set the next pointer as the next-next pointer
-            Set_Next_Pointer(free, temp->packed_pointer);
-
-            // New size including header
-            int new_size = sizeof(BLOCK_HEADER) + Get_Size(free) + Get_Size(temp);
-            Set_Size(free, new_size);
-        }
-        return 0;
+    if (Is_Slab(block) || Is_Remote(block)) return 0;
+    if (Arena_Offset(arena, Get_User_Pointer(block)) == arena->handles) return 1;
+
+    handle = *(unsigned *)Get_User_Pointer(block);
+    return handle != 0 && handle < arena->handle_count &&
+           Handle_Table(arena)[handle].block == Arena_Offset(arena, block) &&
+           Handle_Table(arena)[handle].locks == 0;
+}
+
+/**
+ * @brief Slides a movable block down to the start of a gap, the caller holds the arena lock
+ *
+ * Everything from the gap up to the block is out of the block list and the
+ * bitmap already.  The block keeps its size, the gap moves up behind it.
+ *
+ * @param block     block for which Handle_Movable holds
+ * @param gap       where the block goes
+ * @return          the start of the gap behind the moved block
+ */
+BLOCK_HEADER *Handle_Move(MEM_ARENA *arena, BLOCK_HEADER *block, BLOCK_HEADER *gap) {
+    size_t extent = (unsigned char *)Get_Next_Header(block) - (unsigned char *)block;
+    unsigned handle = *(unsigned *)Get_User_Pointer(block);
+    int table = Arena_Offset(arena, Get_User_Pointer(block)) == arena->handles;
+
+    Unmark_Header(block);
+    memmove(gap, block, extent);
+    Mark_Header(gap);
+    Set_Next_Pointer(gap, (BLOCK_HEADER *)((unsigned char *)gap + extent));
+    Clear_Prev_Free(gap);
+
+    if (table) {
+        arena->handles = Arena_Offset(arena, Get_User_Pointer(gap));
+    } else {
+        Handle_Table(arena)[handle].block = Arena_Offset(arena, gap);
+        Profile_Move(Get_User_Pointer(block), Get_User_Pointer(gap));
     }
+    return (BLOCK_HEADER *)((unsigned char *)gap + extent);
+}
 
-    while (Get_Free(curr) != free && curr != free) {
-        // printf("\n\nStarting at: %p\tNext up: %p\n", curr, Get_Free(curr));
-        if (Get_Free(curr) == NULL) {
-            // printf("Trying to free something that don't exist!\n");
-            return -1;
-        }
+/**
+ * @brief Turns a gap left by compaction into one free block, the caller holds the arena lock
+ *
+ * @param gap   start of the gap, the block before it already links to it
+ * @param block the block right after the gap
+ */
+void Handle_Close_Gap(BLOCK_HEADER *gap, BLOCK_HEADER *block) {
+    Init_Header(gap);
+    Set_Next_Pointer(gap, block);
+    Set_Size(gap, Get_Block_Size(gap));
+    Mark_Header(gap);
+    Set_Footer(gap);
+    Set_Prev_Free(block);
+    Index_Insert(gap);
+}
 
-        if (Is_Allocated(curr)) {
-            // printf("Is allocated\n");
+/**
+ * @brief Allocates a block that is reached through a handle and may be moved by compaction
+ *
+ * Blocks of handles always come from the heap, whatever their size.
+ *
+ * @param arena arena to allocate from
+ * @param size  bytes wanted
+ * @return      the handle, 0 on failure
+ */
+MEM_HANDLE Mem_Arena_Alloc_Handle(MEM_ARENA *arena, int size) {
+    MEM_HANDLE handle = 0;
+    HANDLE *entry;
+    unsigned *block;
 
-            // Saves a refrence to
-            BLOCK_HEADER *temp = curr;
+    if (arena == NULL || size < 1 || size > INT32_MAX / 2) return 0;
 
-            // Sets the last bit to 0
-            Set_Free(curr);
+    Arena_Lock(arena);
+    if ((arena->handle_free != 0 || Handle_Grow(arena) == 0) &&
+        (block = Heap_Alloc(arena, size + GRANULE)) != NULL) {
+        // The granule that keeps the handle counts as padding, like in any block
+        Stats_Used(Get_Header_From_User_Pointer(block), -1);
+        Set_Size(Get_Header_From_User_Pointer(block), size);
+        Stats_Used(Get_Header_From_User_Pointer(block), 1);
 
-            // Traverses to the free address
-            curr = Get_Next_Header(curr);
+        handle = arena->handle_free;
+        entry = &Handle_Table(arena)[handle];
+        arena->handle_free = entry->locks;
+        entry->block = Arena_Offset(arena, Get_Header_From_User_Pointer(block));
+        entry->locks = 0;
+        *block = handle;
 
-            // Make the original back to allocated
-            Set_Allocated(temp);
-            // printf("new: %p\n\n", curr);
-        } else if (Is_Free(curr)) {
-            curr = Get_Next_Header(curr);
-        } else {
-            printf("Somethings wrong: freeing traverse error\n");
+        // The sample is keyed by the block, compaction could move it once the lock is gone
+        Profile_Alloc(block, size);
+    }
+    pthread_mutex_unlock(&arena->lock);
+    Stats_Count(handle ? &arena->alloc_count : &arena->failed_allocs, 1);
+    return handle;
+}
+
+MEM_HANDLE Mem_Alloc_Handle(int size) { return Mem_Arena_Alloc_Handle(default_arena, size); }
+
+/**
+ * @brief Pins the block of a handle in place and returns its address
+ *
+ * Every Mem_Arena_Lock_Handle needs a Mem_Arena_Unlock_Handle before
+ * compaction may move the block again.
+ *
+ * @return  the user writeable address of the block, NULL if the handle is not in use
+ */
+void *Mem_Arena_Lock_Handle(MEM_ARENA *arena, MEM_HANDLE handle) {
+    HANDLE *entry;
+    void *ptr = NULL;
+
+    if (arena == NULL) return NULL;
+
+    pthread_mutex_lock(&arena->lock);
+    if ((entry = Handle_Entry(arena, handle)) != NULL) {
+        entry->locks++;
+        ptr = (unsigned char *)Get_User_Pointer(Arena_At(arena, entry->block)) + GRANULE;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    return ptr;
+}
+
+void *Mem_Lock(MEM_HANDLE handle) { return Mem_Arena_Lock_Handle(default_arena, handle); }
+
+/**
+ * @brief Undoes one Mem_Arena_Lock_Handle, the address it returned may go stale afterwards
+ *
+ * @return  0 on success, -1 if the handle is not in use or not locked
+ */
+int Mem_Arena_Unlock_Handle(MEM_ARENA *arena, MEM_HANDLE handle) {
+    HANDLE *entry;
+    int ret = -1;
+
+    if (arena == NULL) return -1;
+
+    pthread_mutex_lock(&arena->lock);
+    if ((entry = Handle_Entry(arena, handle)) != NULL && entry->locks > 0) {
+        entry->locks--;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    return ret;
+}
+
+int Mem_Unlock(MEM_HANDLE handle) { return Mem_Arena_Unlock_Handle(default_arena, handle); }
+
+/**
+ * @brief Frees the block of a handle and the handle itself
+ *
+ * @return  0 on success, -1 if the handle is not in use or still locked
+ */
+int Mem_Arena_Free_Handle(MEM_ARENA *arena, MEM_HANDLE handle) {
+    HANDLE *entry;
+    int ret = -1;
+
+    if (arena == NULL) return -1;
+
+    Arena_Lock(arena);
+    if ((entry = Handle_Entry(arena, handle)) != NULL && entry->locks == 0) {
+        Profile_Free(Get_User_Pointer(Arena_At(arena, entry->block)));
+        Heap_Release(arena, Arena_At(arena, entry->block));
+        entry->block = 0;
+        entry->locks = arena->handle_free;
+        arena->handle_free = handle;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&arena->lock);
+    if (ret == 0) Stats_Count(&arena->free_count, 1);
+    return ret;
+}
+
+int Mem_Free_Handle(MEM_HANDLE handle) { return Mem_Arena_Free_Handle(default_arena, handle); }
+
+/**
+ * @brief Slides the blocks of unlocked handles down the heap so the free space runs together
+ *
+ * One pass over the block list.  Free blocks are taken out, blocks that may
+ * move close up behind whatever was placed last, and the space left in
+ * front of a block that may not (a plain allocation, a slab or a locked
+ * handle) and at the end of the heap becomes one free block each.  With
+ * nothing pinned all free space ends up in a single block at the end.
+ *
+ * @param arena arena to compact
+ * @return      the number of blocks moved, -1 if arena is NULL
+ */
+int Mem_Arena_Compact(MEM_ARENA *arena) {
+    BLOCK_HEADER *block;
+    BLOCK_HEADER *next;
+    BLOCK_HEADER *gap = NULL;
+    int moved = 0;
+
+    if (arena == NULL) return -1;
+
+    Arena_Lock(arena);
+    Quick_Flush(arena);
+    for (block = First_Header(arena); (next = Get_Next_Header(block)) != NULL; block = next) {
+        if (Is_Free(block)) {
+            Index_Remove(block);
+            Unmark_Header(block);
+            if (gap == NULL) gap = block;
+        } else if (gap != NULL && Handle_Movable(arena, block)) {
+            gap = Handle_Move(arena, block, gap);
+            moved++;
+        } else if (gap != NULL) {
+            Handle_Close_Gap(gap, block);
+            gap = NULL;
         }
     }
+    if (gap != NULL) Handle_Close_Gap(gap, block);
+
+    // The rover may have pointed into a gap
+    arena->rover = arena->first;
+    pthread_mutex_unlock(&arena->lock);
+    return moved;
+}
+
+int Mem_Compact() { return Mem_Arena_Compact(default_arena); }
+
+// #################################################################################
+// ###############                   Regions                    ####################
+// #################################################################################
+
+/**
+ ** A region hands out memory by bumping a pointer through chunks it takes
+ ** from the heap of an arena as ordinary blocks.  Its objects have no
+ ** header and are never freed one by one, they all go at once with
+ ** Mem_Region_Reset or Mem_Region_Destroy, which only free the chunks.
+ **
+ ** The MEM_REGION itself sits at the start of its first chunk, which is
+ ** kept by a reset, so a region that is reset after every request settles
+ ** on its first chunk and does not touch the heap again until it
+ ** outgrows it.  Requests of more than a quarter of a chunk get a chunk of
+ ** their own, so the chunk being filled is not given up for them.
+ ** Regions are not thread safe, a region belongs to one thread at a time.
+ **
+ ** Chunks always come from the heap, whatever the mmap threshold, and
+ ** everything is linked by offsets like the block list, so a region lives
+ ** entirely inside the arena window and its arena is found from its
+ ** address.  That makes regions work in heap files and shared arenas,
+ ** mapped at any address.
+ */
+typedef struct REGION_CHUNK {
+    unsigned next;  // offset of the next chunk of the region, 0 for the last
+    unsigned size;  // bytes of the chunk after this header
+} REGION_CHUNK;
+
+struct MEM_REGION {
+    unsigned chunk_size;  // bytes of a chunk after its header
+    unsigned chunks;      // offset of the chunk being filled, followed by the others
+    unsigned next;        // offset of the first unused byte of the chunk being filled
+    unsigned end;         // offset of the end of the chunk being filled
+};
+
+#define REGION_CHUNK_SIZE (64 * 1024)  // default bytes per chunk
+#define REGION_CHUNK_MIN 256
+
+/**
+ * @brief Returns the chunk a region sits in, the one a reset keeps
+ */
+REGION_CHUNK *Region_First(MEM_REGION *region) { return (REGION_CHUNK *)region - 1; }
+
+/**
+ * @brief Takes a block of the heap for a chunk of 'size' bytes, never a mapping of its own
+ *
+ * @return  the chunk, NULL if the heap has no room and cannot grow
+ */
+REGION_CHUNK *Region_Take(MEM_ARENA *arena, unsigned size) {
+    REGION_CHUNK *chunk;
+
+    Arena_Lock(arena);
+    if ((chunk = Heap_Alloc(arena, sizeof(REGION_CHUNK) + size)) != NULL) chunk->size = size;
+    pthread_mutex_unlock(&arena->lock);
+    return Profile_Alloc(Stats_Alloc(arena, chunk), sizeof(REGION_CHUNK) + size);
+}
+
+/**
+ * @brief Takes a chunk of 'size' bytes from the arena and links it in behind the current one
+ *
+ * @return  the chunk, NULL if the arena has no room
+ */
+REGION_CHUNK *Region_Chunk(MEM_REGION *region, unsigned size) {
+    MEM_ARENA *arena = Arena_Of(region);
+    REGION_CHUNK *current = Arena_At(arena, region->chunks);
+    REGION_CHUNK *chunk = Region_Take(arena, size);
+
+    if (chunk == NULL) return NULL;
+    chunk->next = current->next;
+    current->next = Arena_Offset(arena, chunk);
+    return chunk;
+}
+
+/**
+ ** Function for creating a region whose chunks are taken from the heap of an arena.
+ *
+ *     Chunks are blocks of the heap whatever the mmap threshold, so a
+ *     chunk, or an object, that does not fit in what the heap can grow to
+ *     cannot be had.
+ *
+ * @param   arena       arena to take the chunks from
+ * @param   chunkSize   bytes per chunk, 0 for the default of 64 KiB
+ * @return  :   the region
+ *              NULL if arena is NULL, chunkSize is negative or the arena has no room
+ */
+MEM_REGION *Mem_Arena_Create_Region(MEM_ARENA *arena, int chunkSize) {
+    REGION_CHUNK *chunk;
+    MEM_REGION *region;
 
-    // Now curr should point to the block that is right above the one to free
-    // printf("Delete block: %p\tsize: %i\tnext: %p\n", free, free->size, free->packed_pointer);
-    // printf("Above block: %p \t size: %i\tnext: %p\n", curr, curr->size, curr->packed_pointer);
+    if (arena == NULL || chunkSize < 0 || chunkSize > INT32_MAX / 2) return NULL;
+    if (chunkSize == 0) chunkSize = REGION_CHUNK_SIZE;
+    if (chunkSize < REGION_CHUNK_MIN) chunkSize = REGION_CHUNK_MIN;
 
-    // Check if need to merge up
-    if (Is_Free(curr)) {
-        // printf("\n\nAbout to coalesce the block ABOVE\n");
+    if ((chunk = Region_Take(arena, sizeof(MEM_REGION) + chunkSize)) == NULL) return NULL;
+    chunk->next = 0;
 
-        // Set above to point to below
-        Set_Next_Pointer(curr, free->packed_pointer);
+    region = (MEM_REGION *)(chunk + 1);
+    region->chunk_size = chunkSize;
+    region->chunks = Arena_Offset(arena, chunk);
+    region->next = Arena_Offset(arena, region + 1);
+    region->end = region->next + chunkSize;
+    return region;
+}
+
+/**
+ * @brief Creates a region in the heap of the default arena, see Mem_Arena_Create_Region
+ */
+MEM_REGION *Mem_Region_Create(int chunkSize) {
+    return Mem_Arena_Create_Region(default_arena, chunkSize);
+}
+
+/**
+ ** Function for allocating 'size' bytes from a region.
+ *
+ *     The object is GRANULE aligned and lasts until the region is reset or
+ *     destroyed, it cannot be freed on its own.
+ *
+ * @param   region  region to allocate from
+ * @param   size    How much space needed
+ * @return  :   the user writeable address of the object
+ *              NULL on failure
+ */
+void *Mem_Region_Alloc(MEM_REGION *region, int size) {
+    MEM_ARENA *arena;
+    REGION_CHUNK *chunk;
+    void *ptr;
+
+    if (region == NULL || size < 1 || size > INT32_MAX / 2) return NULL;
+    size = Pad_Size(size);
+    arena = Arena_Of(region);
 
-        // New size including header
-        int new_size = sizeof(BLOCK_HEADER) + Get_Size(free) + Get_Size(curr);
-        Set_Size(curr, new_size);
+    if ((unsigned)size <= region->end - region->next) {
+        ptr = Arena_At(arena, region->next);
+        region->next += size;
+        return ptr;
+    }
 
-        // Remove the pointer to freed block
-        free = curr;
+    // Big objects get a chunk of their own, the chunk being filled stays in use
+    if ((unsigned)size > region->chunk_size / 4) {
+        chunk = Region_Chunk(region, size);
+        return chunk == NULL ? NULL : chunk + 1;
     }
 
-    if (Is_Free(free->packed_pointer)) {
-        // printf("\n\nAbout to coalesce the block BELOW\n");
-        BLOCK_HEADER *temp = free->packed_pointer;
-        // Set the next pointer as the next-next pointer
-        Set_Next_Pointer(free, temp->packed_pointer);
+    // A new chunk to fill moves to the front of the list
+    if ((chunk = Region_Chunk(region, region->chunk_size)) == NULL) return NULL;
+    ((REGION_CHUNK *)Arena_At(arena, region->chunks))->next = chunk->next;
+    chunk->next = region->chunks;
+    region->chunks = Arena_Offset(arena, chunk);
+    region->next = Arena_Offset(arena, chunk + 1) + size;
+    region->end = Arena_Offset(arena, chunk + 1) + chunk->size;
+    return chunk + 1;
+}
+
+/**
+ ** Function for freeing every object of a region at once.
+ *
+ *     All chunks but the first go back to the heap in one pass under a
+ *     single lock, the region starts over at the beginning of the first
+ *     one.  Each chunk is still coalesced on its own, so the cost grows
+ *     with the number of chunks, not with the number of objects.
+ *
+ * @param   region  region to reset
+ */
+void Mem_Region_Reset(MEM_REGION *region) {
+    MEM_ARENA *arena;
+    REGION_CHUNK *first;
+    REGION_CHUNK *chunk;
+    unsigned offset;
+    unsigned next;
+    unsigned freed = 0;
+
+    if (region == NULL) return;
+    arena = Arena_Of(region);
+    first = Region_First(region);
 
-        // New size including header
-        int new_size = sizeof(BLOCK_HEADER) + Get_Size(free) + Get_Size(temp);
-        Set_Size(free, new_size);
+    Arena_Lock(arena);
+    for (offset = region->chunks; offset != 0; offset = next) {
+        chunk = Arena_At(arena, offset);
+        next = chunk->next;
+        if (chunk == first) continue;
+        Profile_Free(chunk);
+        Heap_Release(arena, Get_Header_From_User_Pointer(chunk));
+        freed++;
     }
+    pthread_mutex_unlock(&arena->lock);
+    Stats_Count(&arena->free_count, freed);
 
-    return 0;
+    first->next = 0;
+    region->chunks = Arena_Offset(arena, first);
+    region->next = Arena_Offset(arena, region + 1);
+    region->end = region->next + region->chunk_size;
+}
+
+/**
+ ** Function for freeing a region and every object of it.
+ *
+ * @param   region  region to destroy
+ * @return  :   0 on success, -1 if region is NULL
+ */
+int Mem_Region_Destroy(MEM_REGION *region) {
+    if (region == NULL) return -1;
+    Mem_Region_Reset(region);
+    return Mem_Arena_Free(Arena_Of(region), Region_First(region));
 }
 
 // #################################################################################
 // ###############                 Memory Dump                 #####################
 // #################################################################################
 
+/**
+ * @brief Reads the running statistics of an arena, without walking the heap
+ *
+ * Everything is taken from counters the block operations keep up to date,
+ * so this is cheap enough to poll from a live process.  Small objects
+ * sitting in thread caches count as in use.  The allocations and frees the
+ * calling thread served from its cache are folded in first, those of other
+ * threads show up every CACHE_LIMIT operations.  bytes_in_use +
+ * padding_bytes + header_bytes + free_bytes always adds up to
+ * heap_size + mapped_size.
+ *
+ * @param arena arena to read
+ * @param stats filled in with the statistics
+ * @return      0 on success, -1 if arena or stats is NULL
+ */
+int Mem_Arena_Get_Stats(MEM_ARENA *arena, MEM_STATS *stats) {
+    CACHE_SLOT *slot;
+    long long slab_space;
+
+    if (arena == NULL || stats == NULL) return -1;
+
+    // The calling thread's own cache operations are exact
+    slot = Cache_Slot(arena);
+    if (slot->arena == arena && slot->serial == arena->serial) Cache_Count(slot);
+
+    Arena_Lock(arena);
+    pthread_mutex_lock(&arena->large_lock);
+    slab_space = (long long)arena->slabs * (SLAB_SIZE - SLAB_HEADER_SIZE);
+    stats->heap_size = arena->size;
+    stats->mapped_size = arena->large_mapped;
+    stats->used_blocks = arena->used_blocks - arena->slabs + arena->slab_objects +
+                         arena->large_blocks;
+    stats->free_blocks = arena->free_blocks;
+    stats->bytes_in_use = (long long)arena->used_bytes - (long long)arena->slabs * SLAB_SIZE +
+                          arena->slab_bytes + arena->large_bytes;
+    stats->free_bytes = arena->free_bytes;
+    stats->header_bytes = (long long)arena->headers * sizeof(BLOCK_HEADER) +
+                          (long long)arena->slabs * SLAB_HEADER_SIZE + arena->large_headers;
+    stats->padding_bytes = (long long)arena->used_block_bytes - arena->used_bytes + slab_space -
+                           arena->slab_bytes + arena->large_mapped - arena->large_bytes -
+                           arena->large_headers;
+    stats->largest_free = Index_Largest(arena);
+    pthread_mutex_unlock(&arena->large_lock);
+    pthread_mutex_unlock(&arena->lock);
+
+    stats->alloc_count = __atomic_load_n(&arena->alloc_count, __ATOMIC_RELAXED);
+    stats->free_count = __atomic_load_n(&arena->free_count, __ATOMIC_RELAXED);
+    stats->failed_allocs = __atomic_load_n(&arena->failed_allocs, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @brief Reads the running statistics of the default arena
+ *
+ * @param stats filled in with the statistics
+ * @return      0 on success, -1 if there is no default arena
+ */
+int Mem_Get_Stats(MEM_STATS *stats) { return Mem_Arena_Get_Stats(default_arena, stats); }
+
+/**
+ * @brief Measures external fragmentation of the free space
+ *
+ * Defined as 1 - largest_free / total_free: 0 when all free space is one block,
+ * approaching 1 as free space is scattered across many small blocks.
+ * Useful to compare how the fitting policies hold up on the same workload.
+ *
+ * @param arena arena to measure
+ * @return      fragmentation in [0, 1], 0 if there is no free space
+ */
+double Mem_Arena_Fragmentation(MEM_ARENA *arena) {
+    unsigned total_free_size = 0;
+    unsigned largest_free_size = 0;
+    BLOCK_HEADER *current;
+
+    if (arena == NULL) return 0;
+    current = First_Header(arena);
+    Arena_Lock(arena);
+    while (Get_Next_Header(current) != NULL) {
+        if (Is_Free(current)) {
+            total_free_size += Get_Size(current);
+            if ((unsigned)Get_Size(current) > largest_free_size)
+                largest_free_size = Get_Size(current);
+        }
+        current = Get_Next_Header(current);
+    }
+    pthread_mutex_unlock(&arena->lock);
+    if (total_free_size == 0) return 0;
+    return 1.0 - (double)largest_free_size / total_free_size;
+}
+
+/**
+ * @brief Fragmentation of the default arena, see Mem_Arena_Fragmentation
+ */
+double Mem_Fragmentation() { return Mem_Arena_Fragmentation(default_arena); }
+
 /**
  **  Function to be used for debugging.
  *   Prints out a list of all the blocks along with the following information for each block.
  *
  *
  *  @param  No.      : Serial number of the block
- *  @param  Status   : free/busy
+ *  @param  Status   : free/busy/slab/parked/mapped, parked blocks are freed but wait on a
+ *                     quick list to coalesce and stay out of the busy totals
  *  @param  Begin    : Address of the first user allocated byte - i.e. start of the payload
  *  @param  End      : Address of the last byte in the block (payload or padding)
  *  @param  Payload  : Payload size of the block - the size requested by the user or free size
@@ -539,17 +4522,23 @@ int Mem_Free(void *ptr) {
  *  @param  T_Size   : Total size of the block (including the header, payload, and padding)
  *  @param  H_Begin  : Address of the block header
  */
-void Mem_Dump() {
+void Mem_Arena_Dump(MEM_ARENA *arena) {
     unsigned id = 0;
     unsigned total_free_size = 0;
     unsigned total_payload_size = 0;
     unsigned total_padding_size = 0;
     unsigned total_used_size =
         sizeof(BLOCK_HEADER);  // end of heap header not counted in loop below
-    char status[5];
+    unsigned largest_free_size = 0;
+    unsigned total_parked_size = 0;
+    size_t total_mapped_size = 0;
+    char status[7];
     unsigned payload = 0;
     unsigned padding = 0;
-    BLOCK_HEADER *current = first_header;
+    BLOCK_HEADER *current;
+
+    if (arena == NULL) return;
+    current = First_Header(arena);
 
     fprintf(stdout,
             "************************************Block list***********************************\n");
@@ -558,26 +4547,48 @@ void Mem_Dump() {
     fprintf(stdout,
             "---------------------------------------------------------------------------------\n");
 
-    while (current->packed_pointer != NULL) {
+    Arena_Lock(arena);
+    while (Get_Next_Header(current) != NULL) {
         id++;
-        BLOCK_HEADER *next = (BLOCK_HEADER *)((unsigned)current->packed_pointer & 0xfffffffe);
+        BLOCK_HEADER *next = Get_Next_Header(current);
         void *begin = (void *)current + sizeof(BLOCK_HEADER);
         void *end = (void *)next - 1;
 
-        if ((unsigned)current->packed_pointer & 1) {  // allocated block
+        if (Is_Allocated(current) && Is_Slab(current)) {  // slab, the objects in use are payload
+            SLAB *slab = Get_User_Pointer(current);
+            unsigned objects = 0;
+
+            for (int i = 0; i < SLAB_WORDS; i++)
+                objects += __builtin_popcount(slab->used[i] & ~slab->cached[i]);
+            strcpy(status, "Slab");
+            payload = objects * slab->size;
+            padding =
+                (unsigned)((uintptr_t)next - (uintptr_t)current) - payload - sizeof(BLOCK_HEADER);
+            total_payload_size += payload;
+            total_padding_size += padding;
+            total_used_size += payload + padding + sizeof(BLOCK_HEADER);
+        } else if (Is_Allocated(current) && Is_Remote(current)) {  // freed, waiting to coalesce
+            strcpy(status, "Parked");
+            payload = Get_Size(current);
+            padding =
+                (unsigned)((uintptr_t)next - (uintptr_t)current) - payload - sizeof(BLOCK_HEADER);
+            total_used_size += sizeof(BLOCK_HEADER);
+            total_parked_size += payload + padding;
+        } else if (Is_Allocated(current)) {  // allocated block
             strcpy(status, "Busy");
-            payload = current->size;
+            payload = Get_Size(current);
             padding =
-                (unsigned)((unsigned)next - (unsigned)current) - payload - sizeof(BLOCK_HEADER);
+                (unsigned)((uintptr_t)next - (uintptr_t)current) - payload - sizeof(BLOCK_HEADER);
             total_payload_size += payload;
             total_padding_size += padding;
             total_used_size += payload + padding + sizeof(BLOCK_HEADER);
         } else {  // free block
             strcpy(status, "Free");
-            payload = current->size;
+            payload = Get_Size(current);
             padding = 0;
             total_used_size += sizeof(BLOCK_HEADER);
             total_free_size += payload;
+            if (payload > largest_free_size) largest_free_size = payload;
         }
         unsigned total_block_size = sizeof(BLOCK_HEADER) + padding + payload;
 
@@ -585,6 +4596,19 @@ void Mem_Dump() {
                 padding, total_block_size, current);
         current = next;
     }
+
+    // Large blocks live in mappings of their own and stay out of the heap totals
+    pthread_mutex_lock(&arena->large_lock);
+    for (LARGE_HEADER *large = arena->large; large != NULL; large = large->next) {
+        size_t map_size = Large_Map_Size(large);
+        id++;
+        total_mapped_size += map_size;
+        fprintf(stdout, "%5d %7s %12p %12p %9u %9zu %8zu %12p\n", id, "Mapped",
+                (void *)large + large->offset, (void *)large + map_size - 1, large->size,
+                map_size - large->size - large->offset, map_size, (void *)large);
+    }
+    pthread_mutex_unlock(&arena->large_lock);
+    pthread_mutex_unlock(&arena->lock);
     fprintf(stdout,
             "---------------------------------------------------------------------------------\n");
     fprintf(stdout,
@@ -593,6 +4617,11 @@ void Mem_Dump() {
     fprintf(stdout, "Total padding size = %d\n", total_padding_size);
     fprintf(stdout, "Total free size = %d\n", total_free_size);
     fprintf(stdout, "Total used size = %d\n", total_used_size);
+    fprintf(stdout, "Largest free size = %d\n", largest_free_size);
+    if (total_parked_size) fprintf(stdout, "Total parked size = %u\n", total_parked_size);
+    if (total_mapped_size) fprintf(stdout, "Total mapped size = %zu\n", total_mapped_size);
+    fprintf(stdout, "Fragmentation = %.2f%%\n",
+            total_free_size ? 100.0 * (1.0 - (double)largest_free_size / total_free_size) : 0.0);
     fprintf(stdout,
             "#################################################################################\n");
     fflush(stdout);
@@ -600,6 +4629,155 @@ void Mem_Dump() {
     return;
 }
 
+/**
+ * @brief Prints the block list of the default arena, see Mem_Arena_Dump
+ */
+void Mem_Dump() { Mem_Arena_Dump(default_arena); }
+
+/**
+ * @brief Fills in the snapshot record of a block of the heap, the caller holds the arena lock
+ *
+ * The payload and padding are counted the way Mem_Arena_Dump counts them.
+ */
+void Snapshot_Block(MEM_ARENA *arena, BLOCK_HEADER *current, MEM_SNAPSHOT_BLOCK *block) {
+    unsigned size = (uintptr_t)Get_Next_Header(current) - (uintptr_t)current - sizeof(BLOCK_HEADER);
+
+    block->offset = (uintptr_t)current - (uintptr_t)First_Header(arena);
+    if (Is_Free(current)) {
+        block->status = MEM_BLOCK_FREE;
+        block->payload = Get_Size(current);
+    } else if (Is_Slab(current)) {
+        SLAB *slab = Get_User_Pointer(current);
+
+        block->status = MEM_BLOCK_SLAB;
+        block->payload = 0;
+        for (int i = 0; i < SLAB_WORDS; i++)
+            block->payload += __builtin_popcount(slab->used[i] & ~slab->cached[i]) * slab->size;
+    } else {
+        // Blocks queued for freeing were drained with the lock, what is left is parked
+        block->status = Is_Remote(current) ? MEM_BLOCK_PARKED : MEM_BLOCK_BUSY;
+        block->payload = Get_Size(current);
+    }
+    block->padding = size - block->payload;
+}
+
+/**
+ * @brief Writes all of a buffer, going on after short writes
+ *
+ * @return  0 on success, -1 if writing failed
+ */
+int Write_All(int fd, const void *data, size_t size) {
+    ssize_t n;
+
+    for (; size > 0; size -= n, data = (const char *)data + n)
+        if ((n = write(fd, data, size)) <= 0) return -1;
+    return 0;
+}
+
+/**
+ * @brief Writes a snapshot as JSON, formatted a few lines at a time on the stack
+ *
+ * @return  0 on success, -1 if writing failed
+ */
+int Snapshot_Write_Json(int fd, MEM_SNAPSHOT_HEADER *header, MEM_SNAPSHOT_BLOCK *blocks) {
+    static const char *status_names[] = {"free", "busy", "slab", "parked", "mapped"};
+    char buffer[4096];
+    int length;
+    unsigned i;
+
+    length = snprintf(buffer, sizeof(buffer),
+                      "{\"time\": %lld, \"policy\": %d, \"heap_size\": %lld, "
+                      "\"mapped_size\": %lld, \"count\": %u, \"blocks\": [\n",
+                      header->time, header->policy, header->heap_size, header->mapped_size,
+                      header->count);
+    for (i = 0; i < header->count; i++) {
+        if (length > (int)sizeof(buffer) - 128) {
+            if (Write_All(fd, buffer, length) != 0) return -1;
+            length = 0;
+        }
+        length += snprintf(buffer + length, sizeof(buffer) - length,
+                           "{\"offset\": %u, \"status\": \"%s\", \"payload\": %u, "
+                           "\"padding\": %u}%s\n",
+                           blocks[i].offset, status_names[blocks[i].status], blocks[i].payload,
+                           blocks[i].padding, i + 1 < header->count ? "," : "");
+    }
+    length += snprintf(buffer + length, sizeof(buffer) - length, "]}\n");
+    return Write_All(fd, buffer, length);
+}
+
+/**
+ ** Function for writing a snapshot of every block of an arena to a file.
+ *
+ *     Unlike Mem_Arena_Dump this is meant for programs: each block of the
+ *     heap, in address order, and then each large block gets a record of
+ *     its offset, status, payload and padding.  MEM_SNAPSHOT_BINARY writes
+ *     a MEM_SNAPSHOT_HEADER followed by the MEM_SNAPSHOT_BLOCKs as they are
+ *     in memory, MEM_SNAPSHOT_JSON writes the same as text.  The records
+ *     are copied out under the arena lock and written after it is released,
+ *     so the arena is only held up for the walk.  tools/snapview reads a
+ *     series of snapshots back.
+ *
+ * @param   arena   arena to take the snapshot of
+ * @param   fd      file descriptor to write to
+ * @param   format  MEM_SNAPSHOT_BINARY or MEM_SNAPSHOT_JSON
+ * @return  :   0 on success
+ *              -1 on bad arguments, or if the records could not be mapped or written
+ */
+int Mem_Arena_Snapshot(MEM_ARENA *arena, int fd, int format) {
+    MEM_SNAPSHOT_HEADER header = {MEM_SNAPSHOT_MAGIC};
+    MEM_SNAPSHOT_BLOCK *blocks;
+    BLOCK_HEADER *current;
+    struct timespec now;
+    size_t map_size;
+    int result;
+
+    if (arena == NULL || (format != MEM_SNAPSHOT_BINARY && format != MEM_SNAPSHOT_JSON))
+        return -1;
+
+    Arena_Lock(arena);
+    pthread_mutex_lock(&arena->large_lock);
+    map_size = ((size_t)arena->headers + arena->large_blocks) * sizeof(MEM_SNAPSHOT_BLOCK);
+    blocks = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (blocks == MAP_FAILED) {
+        pthread_mutex_unlock(&arena->large_lock);
+        pthread_mutex_unlock(&arena->lock);
+        return -1;
+    }
+
+    for (current = First_Header(arena); Get_Next_Header(current) != NULL;
+         current = Get_Next_Header(current))
+        Snapshot_Block(arena, current, &blocks[header.count++]);
+    for (LARGE_HEADER *large = arena->large; large != NULL; large = large->next) {
+        MEM_SNAPSHOT_BLOCK *block = &blocks[header.count++];
+
+        block->offset = 0;
+        block->status = MEM_BLOCK_MAPPED;
+        block->payload = large->size;
+        block->padding = Large_Map_Size(large) - large->offset - large->size;
+    }
+    header.heap_size = arena->size;
+    header.mapped_size = arena->large_mapped;
+    header.policy = arena->policy;
+    pthread_mutex_unlock(&arena->large_lock);
+    pthread_mutex_unlock(&arena->lock);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.time = now.tv_sec * 1000000000LL + now.tv_nsec;
+    if (format == MEM_SNAPSHOT_JSON) {
+        result = Snapshot_Write_Json(fd, &header, blocks);
+    } else {
+        result = Write_All(fd, &header, sizeof(header));
+        if (result == 0) result = Write_All(fd, blocks, header.count * sizeof(MEM_SNAPSHOT_BLOCK));
+    }
+    munmap(blocks, map_size);
+    return result;
+}
+
+/**
+ * @brief Writes a snapshot of the default arena, see Mem_Arena_Snapshot
+ */
+int Mem_Snapshot(int fd, int format) { return Mem_Arena_Snapshot(default_arena, fd, format); }
+
 /**
  * @brief For testing purposes
  * 
@@ -611,9 +4789,9 @@ int main() {
     Mem_Init(4097, FIRST_FIT);
     printf("Size is %i\n", 32);
     
-    BLOCK_HEADER *block = first_header;
+    BLOCK_HEADER *block = First_Header(default_arena);
     printf("First header at: %p\n", block);
-    printf("Space: %i\n", block->size);
+    printf("Space: %i\n", Get_Size(block));
 
     printf("Next header is: %p\n", Get_Next_Header(block));
 
@@ -629,11 +4807,10 @@ int main() {
 
     printf("\n\n");
 
-    printf("Block: %p \t point: %p \t, is allocated: %i\n", block, block->packed_pointer, Is_Allocated(block));
+    printf("Block: %p \t next: %p \t, is allocated: %i\n", block, Get_Next_Header(block), Is_Allocated(block));
 
-    //block->packed_pointer = Set_Allocated(block->packed_pointer);
     Set_Allocated(block);
-    printf("Block: %p \t point: %p \t, is allocated: %i\n", block, block->packed_pointer, Is_Allocated(block));
+    printf("Block: %p \t next: %p \t, is allocated: %i\n", block, Get_Next_Header(block), Is_Allocated(block));
     
 
     int *a = Mem_Alloc(6);
@@ -655,4 +4832,4 @@ int main() {
 
     Mem_Dump();
 }
-*/
\ No newline at end of file
+*/
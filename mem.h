@@ -1,12 +1,132 @@
 #ifndef __mem_h__
 #define __mem_h__
 
-enum POLICY{BEST_FIT, FIRST_FIT, NEXT_FIT, WORST_FIT};
+enum POLICY{BEST_FIT, FIRST_FIT, NEXT_FIT, WORST_FIT, TLSF};
+
+// How Mem_Init_Flags and Mem_Arena_Create_Flags map the heap
+#define MEM_MAP_ANONYMOUS 1  // anonymous memory instead of /dev/zero, no file descriptor
+#define MEM_MAP_HUGETLB 2    // explicit huge pages, they must be reserved in the system
+#define MEM_MAP_THP 4        // ask for transparent huge pages with madvise
+#define MEM_MAP_POPULATE 8   // fault every page in when it is mapped
+#define MEM_MAP_LOCK 16      // mlock the heap so it is never paged out
+
+typedef struct MEM_ARENA MEM_ARENA;
+typedef struct MEM_REGION MEM_REGION;
+typedef unsigned MEM_HANDLE;  // names a block Mem_Compact may move, 0 for none
+
+typedef struct MEM_STATS {
+    long long heap_size;      // bytes of the heap
+    long long mapped_size;    // bytes mapped for large blocks
+    long long bytes_in_use;   // bytes requested for live allocations
+    long long free_bytes;     // payload of the free blocks of the heap
+    long long padding_bytes;  // bytes of live blocks, slabs and mappings beyond the requests
+    long long header_bytes;   // block, slab and large block headers
+    int used_blocks;          // live allocations
+    int free_blocks;          // free blocks of the heap
+    unsigned largest_free;    // payload of the largest free block
+    // Allocations and frees other threads served from their thread caches are
+    // counted every 32 operations of theirs, so these may lag behind by that much
+    unsigned long long alloc_count;
+    unsigned long long free_count;
+    unsigned long long failed_allocs;
+} MEM_STATS;
+
+// Formats of Mem_Snapshot
+#define MEM_SNAPSHOT_BINARY 0  // a MEM_SNAPSHOT_HEADER followed by its MEM_SNAPSHOT_BLOCKs
+#define MEM_SNAPSHOT_JSON 1    // one JSON object, a line per block
+#define MEM_SNAPSHOT_MAGIC 0x504e534d  // "MSNP"
+
+// Status of a block in a snapshot
+enum MEM_BLOCK_STATUS {MEM_BLOCK_FREE, MEM_BLOCK_BUSY, MEM_BLOCK_SLAB, MEM_BLOCK_PARKED,
+                       MEM_BLOCK_MAPPED};
+
+typedef struct MEM_SNAPSHOT_HEADER {
+    unsigned magic;          // MEM_SNAPSHOT_MAGIC
+    unsigned count;          // blocks that follow
+    long long time;          // nanoseconds since the epoch when the snapshot was taken
+    long long heap_size;     // bytes of the heap
+    long long mapped_size;   // bytes mapped for large blocks
+    int policy;              // fitting policy of the arena
+    int reserved;
+} MEM_SNAPSHOT_HEADER;
+
+typedef struct MEM_SNAPSHOT_BLOCK {
+    unsigned offset;   // bytes from the start of the heap to the block header, 0 for mapped blocks
+    unsigned status;   // enum MEM_BLOCK_STATUS
+    unsigned payload;  // bytes requested, or the payload of a free block
+    unsigned padding;  // bytes of the block beyond its header and payload
+} MEM_SNAPSHOT_BLOCK;
 
 int Mem_Init(int sizeOfRegion, enum POLICY policy_input);
+int Mem_Init_Flags(int sizeOfRegion, enum POLICY policy_input, int flags);
+int Mem_Init_File(const char *path, int sizeOfRegion, enum POLICY policy_input);
+int Mem_Close();
 void *Mem_Alloc(int size);
+void *Mem_Alloc_Aligned(int size, int alignment);
+void *Mem_Realloc(void *ptr, int size);
+int Mem_Usable_Size(void *ptr);
+int Mem_Alloc_Batch(int size, int n, void **out);
+int Mem_Free_Batch(void **ptrs, int n);
 int Mem_Free(void *ptr);
 void Mem_Dump();
+int Mem_Snapshot(int fd, int format);
+double Mem_Fragmentation();
+int Mem_Get_Stats(MEM_STATS *stats);
+void Mem_Cache_Flush();
+int Mem_Set_Profile_Rate(int rate);
+int Mem_Profile_Dump(int fd);
+int Mem_Set_Max_Size(int maxSize);
+int Mem_Set_Mmap_Threshold(int threshold);
+int Mem_Set_Deferred(int limit);
+MEM_HANDLE Mem_Alloc_Handle(int size);
+void *Mem_Lock(MEM_HANDLE handle);
+int Mem_Unlock(MEM_HANDLE handle);
+int Mem_Free_Handle(MEM_HANDLE handle);
+int Mem_Compact();
+// Regions take every chunk from the heap, never from a mapping of its own, and link them by
+// offsets, so they work in heap files and shared arenas.  A region belongs to one thread at a
+// time.  Mem_Region_Reset frees the chunks but the first under one lock, its cost grows with
+// the number of chunks.
+MEM_REGION *Mem_Region_Create(int chunkSize);
+void *Mem_Region_Alloc(MEM_REGION *region, int size);
+void Mem_Region_Reset(MEM_REGION *region);
+int Mem_Region_Destroy(MEM_REGION *region);
+int Mem_Set_Root(void *ptr);
+void *Mem_Get_Root();
+
+MEM_ARENA *Mem_Arena_Create(int sizeOfRegion, enum POLICY policy);
+MEM_ARENA *Mem_Arena_Create_Flags(int sizeOfRegion, enum POLICY policy, int flags);
+MEM_ARENA *Mem_Arena_Open_File(const char *path, int sizeOfRegion, enum POLICY policy);
+MEM_ARENA *Mem_Arena_Create_Shared(const char *name, int sizeOfRegion, enum POLICY policy);
+MEM_ARENA *Mem_Arena_Open_Shared(const char *name);
+void *Mem_Arena_Alloc(MEM_ARENA *arena, int size);
+void *Mem_Arena_Alloc_Aligned(MEM_ARENA *arena, int size, int alignment);
+void *Mem_Arena_Realloc(MEM_ARENA *arena, void *ptr, int size);
+int Mem_Arena_Usable_Size(MEM_ARENA *arena, void *ptr);
+int Mem_Arena_Alloc_Batch(MEM_ARENA *arena, int size, int n, void **out);
+int Mem_Arena_Free_Batch(MEM_ARENA *arena, void **ptrs, int n);
+int Mem_Arena_Free(MEM_ARENA *arena, void *ptr);
+int Mem_Arena_Destroy(MEM_ARENA *arena);
+void Mem_Fork_Prepare();
+void Mem_Fork_Parent();
+void Mem_Fork_Child();
+int Mem_Arena_Set_Max_Size(MEM_ARENA *arena, int maxSize);
+int Mem_Arena_Set_Mmap_Threshold(MEM_ARENA *arena, int threshold);
+int Mem_Arena_Set_Deferred(MEM_ARENA *arena, int limit);
+MEM_HANDLE Mem_Arena_Alloc_Handle(MEM_ARENA *arena, int size);
+void *Mem_Arena_Lock_Handle(MEM_ARENA *arena, MEM_HANDLE handle);
+int Mem_Arena_Unlock_Handle(MEM_ARENA *arena, MEM_HANDLE handle);
+int Mem_Arena_Free_Handle(MEM_ARENA *arena, MEM_HANDLE handle);
+int Mem_Arena_Compact(MEM_ARENA *arena);
+MEM_REGION *Mem_Arena_Create_Region(MEM_ARENA *arena, int chunkSize);
+void Mem_Arena_Dump(MEM_ARENA *arena);
+int Mem_Arena_Snapshot(MEM_ARENA *arena, int fd, int format);
+double Mem_Arena_Fragmentation(MEM_ARENA *arena);
+int Mem_Arena_Get_Stats(MEM_ARENA *arena, MEM_STATS *stats);
+int Mem_Arena_Set_Root(MEM_ARENA *arena, void *ptr);
+void *Mem_Arena_Get_Root(MEM_ARENA *arena);
+unsigned Mem_Arena_Offset(MEM_ARENA *arena, void *ptr);
+void *Mem_Arena_Pointer(MEM_ARENA *arena, unsigned offset);
 
 #endif // __mem_h__
 
@@ -0,0 +1,298 @@
+/******************************************************************************
+ * FILENAME: preload.c
+ * PROVIDES: malloc, free, calloc, realloc and friends on top of libmem, so
+ *           that unmodified programs can be run on it:
+ *
+ *               LD_PRELOAD=./libmempreload.so program
+ *
+ * The heap is set up on the first call.  It starts out at LIBMEM_HEAP_SIZE
+ * bytes (default 16 MiB), grows up to the largest heap an arena can have,
+ * and uses the policy named by LIBMEM_POLICY (BEST_FIT, FIRST_FIT,
+ * NEXT_FIT, WORST_FIT or TLSF, default TLSF).
+ *
+ * Setting LIBMEM_PROFILE_RATE turns on the heap profiler with that many
+ * bytes between samples, and the profile is written to the file named by
+ * LIBMEM_PROFILE (default libmem.heap) when the program exits.
+ * *****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define PRELOAD_HEAP_SIZE (16 << 20)
+#define PRELOAD_ALIGNMENT 16    // what malloc must return, the alignment of max_align_t
+#define PRELOAD_SMALL_SIZE 64   // sizes up to this are slab objects, which keep the alignment
+#define BOOTSTRAP_SIZE (64 * 1024)
+
+/**
+ ** The arena is created by whichever thread calls in first, the others wait
+ ** for it.  Creating it does not allocate, but should anything called on
+ ** the way (or a malloc hook of the C library) allocate anyway, that thread
+ ** is served from a small static buffer instead of waiting for itself.
+ ** Blocks of the buffer are never reused, freeing them does nothing.
+ */
+MEM_ARENA *preload_arena;
+int preload_state;                 // 0 before the arena is set up, 1 while it is, 2 once it is
+__thread int preload_initializing;  // the calling thread is the one setting up the arena
+
+unsigned char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(PRELOAD_ALIGNMENT)));
+size_t bootstrap_used;
+
+const char *policy_names[] = {"BEST_FIT", "FIRST_FIT", "NEXT_FIT", "WORST_FIT", "TLSF"};
+
+/**
+ * @brief Creates the arena behind malloc, configured from the environment
+ *
+ * Aborts when the arena cannot be created, there is nothing else to
+ * allocate from.
+ */
+void Preload_Init() {
+    const char *policy_name = getenv("LIBMEM_POLICY");
+    const char *heap_size = getenv("LIBMEM_HEAP_SIZE");
+    enum POLICY policy = TLSF;
+    int size = PRELOAD_HEAP_SIZE;
+
+    for (int i = 0; policy_name != NULL && i <= TLSF; i++)
+        if (strcmp(policy_name, policy_names[i]) == 0) policy = i;
+    if (heap_size != NULL && atoi(heap_size) > 0) size = atoi(heap_size);
+
+    preload_arena = Mem_Arena_Create(size, policy);
+    if (preload_arena == NULL) {
+        static const char message[] = "libmempreload: could not create the heap\n";
+        write(STDERR_FILENO, message, sizeof(message) - 1);
+        abort();
+    }
+    Mem_Arena_Set_Max_Size(preload_arena, INT32_MAX);
+
+    // A child forked while another thread holds a lock would wait for it on its first malloc
+    pthread_atfork(Mem_Fork_Prepare, Mem_Fork_Parent, Mem_Fork_Child);
+
+    // Sampling starts here, where whatever the unwinder allocates is served from the static buffer
+    if (getenv("LIBMEM_PROFILE_RATE") != NULL && atoi(getenv("LIBMEM_PROFILE_RATE")) > 0)
+        Mem_Set_Profile_Rate(atoi(getenv("LIBMEM_PROFILE_RATE")));
+}
+
+/**
+ * @brief Writes the heap profile when the program exits, if LIBMEM_PROFILE_RATE turned it on
+ */
+__attribute__((destructor)) void Preload_Profile_Dump() {
+    const char *path = getenv("LIBMEM_PROFILE");
+    int fd;
+
+    if (preload_state != 2 || getenv("LIBMEM_PROFILE_RATE") == NULL ||
+        atoi(getenv("LIBMEM_PROFILE_RATE")) <= 0)
+        return;
+    if ((fd = open(path != NULL ? path : "libmem.heap", O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return;
+    Mem_Profile_Dump(fd);
+    close(fd);
+}
+
+/**
+ * @brief Returns the arena behind malloc, setting it up on the first call
+ *
+ * @return  the arena, NULL if the calling thread is setting it up right now
+ */
+MEM_ARENA *Preload_Arena() {
+    int state = __atomic_load_n(&preload_state, __ATOMIC_ACQUIRE);
+    int expected = 0;
+
+    if (state == 2) return preload_arena;
+    if (preload_initializing) return NULL;
+
+    if (__atomic_compare_exchange_n(&preload_state, &expected, 1, 0, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_ACQUIRE)) {
+        preload_initializing = 1;
+        Preload_Init();
+        preload_initializing = 0;
+        __atomic_store_n(&preload_state, 2, __ATOMIC_RELEASE);
+    }
+    while (__atomic_load_n(&preload_state, __ATOMIC_ACQUIRE) != 2) sched_yield();
+    return preload_arena;
+}
+
+/**
+ * @brief Carves a block out of the static buffer, for allocations made while the arena is set up
+ *
+ * The size is kept in front of the block for realloc and malloc_usable_size.
+ *
+ * @return  the block, NULL once the buffer is used up
+ */
+void *Bootstrap_Alloc(size_t size) {
+    size_t *block;
+    size_t total;
+
+    if (size > BOOTSTRAP_SIZE) return NULL;
+    total = PRELOAD_ALIGNMENT + ((size + PRELOAD_ALIGNMENT - 1) & ~(size_t)(PRELOAD_ALIGNMENT - 1));
+    if (total > BOOTSTRAP_SIZE - bootstrap_used) return NULL;
+    block = (size_t *)(bootstrap + bootstrap_used + PRELOAD_ALIGNMENT);
+    block[-1] = size;
+    bootstrap_used += total;
+    return block;
+}
+
+/**
+ * Checks if a block came from the static buffer
+ */
+int Is_Bootstrap(void *ptr) {
+    return (unsigned char *)ptr >= bootstrap && (unsigned char *)ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+/**
+ * @brief Returns the size to ask libmem for so the block comes out 16 byte aligned
+ *
+ * Blocks of the heap are only 8 byte aligned.  A block whose header and
+ * payload add up to a multiple of 16 leaves the next block as aligned as
+ * itself, so once one block is aligned the blocks carved after it are too
+ * and aligning them costs no slack.
+ *
+ * @return  the size to allocate, 0 if the request is too big for libmem
+ */
+int Preload_Size(size_t size) {
+    if (size > INT32_MAX / 2) return 0;
+    size = (size + PRELOAD_ALIGNMENT - 1) & ~(size_t)(PRELOAD_ALIGNMENT - 1);
+    if (size == 0) size = PRELOAD_ALIGNMENT;
+    return size <= PRELOAD_SMALL_SIZE ? size : size + sizeof(void *);
+}
+
+/**
+ * @brief Allocates a 16 byte aligned block of the arena
+ *
+ * Small requests are slab objects of a size class that is a multiple of
+ * 16, which are aligned by themselves.  The rare small block that comes
+ * from the heap because there was no room for a slab is replaced.
+ */
+void *Preload_Alloc(MEM_ARENA *arena, int size) {
+    void *ptr;
+
+    if (size <= PRELOAD_SMALL_SIZE) {
+        ptr = Mem_Arena_Alloc(arena, size);
+        if (ptr == NULL || (uintptr_t)ptr % PRELOAD_ALIGNMENT == 0) return ptr;
+        Mem_Arena_Free(arena, ptr);
+    }
+    return Mem_Arena_Alloc_Aligned(arena, size, PRELOAD_ALIGNMENT);
+}
+
+// #################################################################################
+// ###############              Exported Functions              ####################
+// #################################################################################
+
+void *malloc(size_t size) {
+    MEM_ARENA *arena = Preload_Arena();
+    int resize = Preload_Size(size);
+    void *ptr;
+
+    if (arena == NULL) return Bootstrap_Alloc(size);
+    if (resize == 0 || (ptr = Preload_Alloc(arena, resize)) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return ptr;
+}
+
+void free(void *ptr) {
+    if (ptr == NULL || Is_Bootstrap(ptr)) return;
+    Mem_Arena_Free(preload_arena, ptr);
+}
+
+void *calloc(size_t count, size_t size) {
+    size_t total;
+    void *ptr;
+
+    if (__builtin_mul_overflow(count, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if ((ptr = malloc(total)) != NULL) memset(ptr, 0, total);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    MEM_ARENA *arena;
+    int resize = Preload_Size(size);
+    size_t old_size;
+    void *moved;
+
+    if (ptr == NULL) return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    if (Is_Bootstrap(ptr)) {
+        old_size = ((size_t *)ptr)[-1];
+        if ((moved = malloc(size)) != NULL) memcpy(moved, ptr, old_size < size ? old_size : size);
+        return moved;
+    }
+
+    arena = Preload_Arena();
+    if (resize == 0 || (moved = Mem_Arena_Realloc(arena, ptr, resize)) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // A block that had to move may have landed on an 8 byte boundary, the old one is gone by now
+    if ((uintptr_t)moved % PRELOAD_ALIGNMENT != 0 && (ptr = Preload_Alloc(arena, resize)) != NULL) {
+        memcpy(ptr, moved, size);
+        Mem_Arena_Free(arena, moved);
+        moved = ptr;
+    }
+    return moved;
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    MEM_ARENA *arena;
+    int resize = Preload_Size(size);
+    void *ptr;
+
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0 ||
+        alignment > INT32_MAX / 2)
+        return EINVAL;
+    if (alignment <= PRELOAD_ALIGNMENT) {
+        if ((ptr = malloc(size)) == NULL) return ENOMEM;
+        *out = ptr;
+        return 0;
+    }
+
+    if ((arena = Preload_Arena()) == NULL) return ENOMEM;
+    if (resize == 0 || (ptr = Mem_Arena_Alloc_Aligned(arena, resize, alignment)) == NULL)
+        return ENOMEM;
+    *out = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    void *ptr;
+    int error;
+
+    if ((error = posix_memalign(&ptr, alignment, size)) != 0) {
+        errno = error;
+        return NULL;
+    }
+    return ptr;
+}
+
+void *memalign(size_t alignment, size_t size) { return aligned_alloc(alignment, size); }
+
+void *valloc(size_t size) { return aligned_alloc(getpagesize(), size); }
+
+void *pvalloc(size_t size) {
+    size_t pagesize = getpagesize();
+    return aligned_alloc(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+size_t malloc_usable_size(void *ptr) {
+    int size;
+
+    if (ptr == NULL) return 0;
+    if (Is_Bootstrap(ptr)) return ((size_t *)ptr)[-1];
+    size = Mem_Arena_Usable_Size(preload_arena, ptr);
+    return size < 0 ? 0 : size;
+}
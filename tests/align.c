@@ -10,7 +10,7 @@ int main() {
     assert(Mem_Init(4096, FIRST_FIT) == 0);
     int* ptr = (int*)Mem_Alloc(sizeof(int));
     assert(ptr != NULL);
-    assert((int)ptr % 4 == 0);
+    assert((uintptr_t)ptr % 4 == 0);
 
     printf("align.c passes!\n");
 
@@ -0,0 +1,48 @@
+/* aligned allocations of every kind can be written and freed like any other */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+#define REGION (16 * 4096)
+
+int main() {
+    assert(Mem_Init(REGION, BEST_FIT) == 0);
+    int sizes[] = {1, 24, 64, 100, 1000, 200000};
+    int alignments[] = {16, 32, 64, 256, 4096};
+    char* ptr[6][5];
+
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j < 5; j++) {
+            ptr[i][j] = Mem_Alloc_Aligned(sizes[i], alignments[j]);
+            assert(ptr[i][j] != NULL);
+            assert((uintptr_t)ptr[i][j] % alignments[j] == 0);
+            memset(ptr[i][j], i * 5 + j, sizes[i]);
+        }
+    }
+    Mem_Dump();
+
+    // not a power of two
+    assert(Mem_Alloc_Aligned(8, 0) == NULL);
+    assert(Mem_Alloc_Aligned(8, 3) == NULL);
+    assert(Mem_Alloc_Aligned(8, 48) == NULL);
+
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j < 5; j++) {
+            assert(ptr[i][j][sizes[i] - 1] == (char)(i * 5 + j));
+            assert(Mem_Free(ptr[i][j]) == 0);
+            assert(Mem_Free(ptr[i][j]) == -1);
+        }
+    }
+
+    // the slack in front of the aligned blocks went back to the heap
+    Mem_Cache_Flush();
+    assert(Mem_Alloc(REGION - 16) != NULL);
+
+    printf("aligned.c passes!\n");
+
+    exit(0);
+}
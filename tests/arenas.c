@@ -0,0 +1,52 @@
+/* independent arenas next to the default one */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+int main() {
+    assert(Mem_Init(4096, FIRST_FIT) == 0);
+    MEM_ARENA* best = Mem_Arena_Create(4096, BEST_FIT);
+    MEM_ARENA* tlsf = Mem_Arena_Create(8192, TLSF);
+    assert(best != NULL && tlsf != NULL && best != tlsf);
+
+    char* a = Mem_Alloc(100);
+    char* b = Mem_Arena_Alloc(best, 100);
+    char* c = Mem_Arena_Alloc(tlsf, 100);
+    assert(a != NULL && b != NULL && c != NULL);
+    memset(a, 'a', 100);
+    memset(b, 'b', 100);
+    memset(c, 'c', 100);
+
+    // a block can only be freed into the arena it came from
+    assert(Mem_Free(b) == -1);
+    assert(Mem_Arena_Free(best, a) == -1);
+    assert(Mem_Arena_Free(tlsf, b) == -1);
+    assert(a[99] == 'a' && b[99] == 'b' && c[99] == 'c');
+
+    // each arena has its whole heap to itself
+    assert(Mem_Arena_Free(best, b) == 0);
+    assert(Mem_Arena_Alloc(best, 4096 - 16) != NULL);
+    assert(Mem_Arena_Alloc(best, 1) == NULL);
+    assert(Mem_Arena_Alloc(tlsf, 4096) != NULL);
+
+    // small blocks cached by this thread go away with their arena
+    char* small = Mem_Arena_Alloc(tlsf, 8);
+    assert(Mem_Arena_Free(tlsf, small) == 0);
+    assert(Mem_Arena_Destroy(tlsf) == 0);
+    assert(Mem_Arena_Destroy(tlsf) == -1);
+    assert(Mem_Arena_Destroy(best) == 0);
+
+    // a new arena starts out empty, the default arena is untouched
+    best = Mem_Arena_Create(4096, BEST_FIT);
+    assert(best != NULL);
+    assert(Mem_Arena_Alloc(best, 4096 - 16) != NULL);
+    assert(a[0] == 'a' && Mem_Free(a) == 0);
+    assert(Mem_Alloc(4096 - 16) != NULL);
+
+    printf("arenas.c passes!\n");
+
+    exit(0);
+}
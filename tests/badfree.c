@@ -0,0 +1,55 @@
+/* invalid and double frees are rejected */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "mem.h"
+
+int main() {
+    assert(Mem_Init(4096, FIRST_FIT) == 0);
+    char* ptr[3];
+
+    ptr[0] = Mem_Alloc(40);
+    ptr[1] = Mem_Alloc(40);
+    ptr[2] = Mem_Alloc(40);
+    assert(ptr[0] != NULL && ptr[1] != NULL && ptr[2] != NULL);
+
+    // pointers into the middle of a payload
+    assert(Mem_Free(ptr[1] + 4) == -1);
+    assert(Mem_Free(ptr[1] + 1) == -1);
+    assert(Mem_Free(ptr[1] - 4) == -1);
+
+    // pointers outside the heap
+    assert(Mem_Free(NULL) == -1);
+    assert(Mem_Free(&ptr) == -1);
+
+    // pointers into memory that is mapped but cannot be read, like a guard page
+    char* guard = mmap(NULL, 2 * 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(guard != MAP_FAILED);
+    assert(Mem_Free(guard + 4096) == -1);
+    assert(Mem_Free(guard + 4096 + 16) == -1);
+    assert(Mem_Realloc(guard + 4096, 10) == NULL);
+    assert(Mem_Usable_Size(guard + 4096) == -1);
+
+    // pointers into the reserved window of another arena
+    MEM_ARENA* other = Mem_Arena_Create(4096, FIRST_FIT);
+    char* in_other = Mem_Arena_Alloc(other, 40);
+    assert(other != NULL && in_other != NULL);
+    assert(Mem_Free(in_other) == -1);
+    assert(Mem_Free(in_other + 64 * 4096) == -1);
+    assert(Mem_Free(in_other + 64 * 4096 + 16) == -1);
+    assert(Mem_Arena_Destroy(other) == 0);
+
+    // double frees, also after the block coalesced with its neighbour
+    assert(Mem_Free(ptr[1]) == 0);
+    assert(Mem_Free(ptr[1]) == -1);
+    assert(Mem_Free(ptr[2]) == 0);
+    assert(Mem_Free(ptr[2]) == -1);
+
+    assert(Mem_Free(ptr[0]) == 0);
+
+    printf("badfree.c passes!\n");
+
+    exit(0);
+}
@@ -0,0 +1,55 @@
+/* batches of blocks are carved side by side and freed in one pass */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+#define REGION (16 * 4096)
+#define COUNT 100
+
+int main() {
+    assert(Mem_Init(REGION, BEST_FIT) == 0);
+    void* ptr[COUNT];
+    void* small[COUNT];
+
+    // heap blocks of a batch lie right next to each other
+    assert(Mem_Alloc_Batch(100, COUNT, ptr) == COUNT);
+    for (int i = 0; i < COUNT; i++) {
+        assert(ptr[i] != NULL);
+        memset(ptr[i], i, 100);
+    }
+    for (int i = 1; i < COUNT; i++) assert((char*)ptr[i] == (char*)ptr[i - 1] + 112);
+
+    assert(Mem_Alloc_Batch(24, COUNT, small) == COUNT);
+    for (int i = 0; i < COUNT; i++) memset(small[i], i, 24);
+    Mem_Dump();
+
+    // out of order, with slab objects mixed in
+    void* mixed[2 * COUNT];
+    for (int i = 0; i < COUNT; i++) {
+        assert(*(char*)ptr[i] == (char)i && *(char*)small[i] == (char)i);
+        mixed[2 * i] = ptr[COUNT - 1 - i];
+        mixed[2 * i + 1] = small[i];
+    }
+    assert(Mem_Free_Batch(mixed, 2 * COUNT) == 0);
+
+    // everything was freed and coalesced
+    Mem_Cache_Flush();
+    void* all = Mem_Alloc(REGION - 16);
+    assert(all != NULL);
+
+    // bad and repeated addresses are reported, the rest is still freed
+    void* bad[3] = {all, all, (char*)all + 8};
+    assert(Mem_Free_Batch(bad, 3) == -1);
+    assert(Mem_Free(all) == -1);
+
+    // a full heap hands out what it has
+    assert(Mem_Alloc_Batch(1000, COUNT, ptr) < COUNT);
+    assert(Mem_Alloc_Batch(0, 10, ptr) == -1);
+
+    printf("batch.c passes!\n");
+
+    exit(0);
+}
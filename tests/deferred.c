@@ -0,0 +1,83 @@
+/* in deferred mode freed blocks are parked for reuse and coalesced in bulk */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define REGION (16 * 4096)
+#define COUNT 16
+
+int main() {
+    MEM_STATS st;
+    void* ptr[REGION / 200];
+    int n;
+
+    assert(Mem_Init(REGION, BEST_FIT) == 0);
+    assert(Mem_Set_Deferred(-1) == -1);
+    assert(Mem_Set_Deferred(COUNT) == 0);
+
+    // the same padded size comes straight back
+    void* a = Mem_Alloc(200);
+    void* guard = Mem_Alloc(100);
+    assert(a != NULL && guard != NULL);
+    assert(Mem_Free(a) == 0);
+    assert(Mem_Free(a) == -1);
+    assert(Mem_Alloc(197) == a);
+    assert(Mem_Usable_Size(a) == 200);
+    assert(Mem_Free(a) == 0);
+
+    // parked blocks count as in use until they coalesce
+    assert(Mem_Get_Stats(&st) == 0);
+    assert(st.used_blocks == 2 && st.free_count == 2 && st.bytes_in_use == 197 + 100);
+
+    // the limit coalesces everything that is parked at once
+    for (int i = 0; i < COUNT - 2; i++) ptr[i] = Mem_Alloc(300 + i * 8);
+    for (int i = 0; i < COUNT - 2; i++) assert(Mem_Free(ptr[i]) == 0);
+    assert(Mem_Get_Stats(&st) == 0 && st.used_blocks == COUNT);
+    assert(Mem_Free(guard) == 0);
+    assert(Mem_Get_Stats(&st) == 0 && st.used_blocks == 0 && st.free_blocks == 1);
+
+    // a request that only fits once parked blocks coalesce still succeeds
+    assert(Mem_Set_Deferred(1000) == 0);
+    for (n = 0; (ptr[n] = Mem_Alloc(180)) != NULL; n++)
+        ;
+    assert(n > 100);
+    for (int i = 0; i < n; i++) assert(Mem_Free(ptr[i]) == 0);
+    a = Mem_Alloc(REGION / 2);
+    assert(a != NULL);
+    assert(Mem_Free(a) == 0);
+
+    // turning it off coalesces right away
+    for (int i = 0; i < 10; i++) ptr[i] = Mem_Alloc(500);
+    for (int i = 0; i < 10; i++) assert(Mem_Free(ptr[i]) == 0);
+    assert(Mem_Set_Deferred(0) == 0);
+    assert(Mem_Get_Stats(&st) == 0 && st.used_blocks == 0 && st.free_blocks == 1);
+
+    // the dump shows a parked block as parked, sized without the flag, and out of the payload
+    assert(Mem_Set_Deferred(COUNT) == 0);
+    a = Mem_Alloc(200);
+    assert(a != NULL && Mem_Alloc(200) != NULL && Mem_Free(a) == 0);
+    char line[256];
+    int payload = -1, parked = -1, parked_lines = 0;
+    FILE* out = tmpfile();
+    int saved = dup(1);
+    fflush(stdout);
+    dup2(fileno(out), 1);
+    Mem_Dump();
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    rewind(out);
+    while (fgets(line, sizeof(line), out) != NULL) {
+        if (strstr(line, " Parked ") != NULL) parked_lines++;
+        sscanf(line, "Total payload size = %d", &payload);
+        sscanf(line, "Total parked size = %d", &parked);
+    }
+    fclose(out);
+    assert(parked_lines == 1 && payload == 200 && parked >= 200);
+    printf("deferred.c passes!\n");
+    exit(0);
+}
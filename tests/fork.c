@@ -0,0 +1,66 @@
+/* a child forked while other threads allocate gets a heap it can use */
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define THREADS 4
+#define COUNT 100
+#define FORKS 200
+
+volatile int done = 0;
+
+void* worker(void* arg) {
+    char* ptr[COUNT];
+
+    while (!done) {
+        for (int i = 0; i < COUNT; i++) {
+            ptr[i] = malloc(i * 97 % 6000 + 1);
+            assert(ptr[i] != NULL);
+            ptr[i][0] = (char)i;
+        }
+        for (int i = 0; i < COUNT; i++) {
+            assert(ptr[i][0] == (char)i);
+            free(ptr[i]);
+        }
+    }
+    return arg;
+}
+
+int main() {
+    pthread_t thread[THREADS];
+
+    free(malloc(1));  // sets up the heap and the fork handlers
+    for (int i = 0; i < THREADS; i++) assert(pthread_create(&thread[i], NULL, worker, NULL) == 0);
+
+    // a child that found a lock taken by a thread it does not have would hang in malloc
+    for (int n = 0; n < FORKS; n++) {
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            alarm(5);
+            char* small = malloc(24);
+            char* big = malloc(3000);
+            char* huge = malloc(1 << 20);
+            assert(small != NULL && big != NULL && huge != NULL);
+            memset(huge, 1, 1 << 20);
+            free(small);
+            free(big);
+            free(huge);
+            _exit(0);
+        }
+        int status;
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    done = 1;
+    for (int i = 0; i < THREADS; i++) assert(pthread_join(thread[i], NULL) == 0);
+    printf("fork.c passes!\n");
+    exit(0);
+}
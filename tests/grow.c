@@ -0,0 +1,38 @@
+/* the heap grows when it runs out of space */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+int main() {
+    assert(Mem_Init(4096, FIRST_FIT) == 0);
+    char* ptr[4];
+
+    // without a larger maximum the heap stays as it is
+    assert(Mem_Alloc(4095) == NULL);
+    assert(Mem_Set_Max_Size(16 * 4096) == 0);
+
+    ptr[0] = Mem_Alloc(3000);
+    ptr[1] = Mem_Alloc(3000);
+    ptr[2] = Mem_Alloc(20000);
+    assert(ptr[0] != NULL && ptr[1] != NULL && ptr[2] != NULL);
+    memset(ptr[2], 'x', 20000);
+    assert(ptr[0] < ptr[1] && ptr[1] < ptr[2]);
+    assert(Mem_Set_Max_Size(4096) == -1);
+
+    // up to the maximum and no further
+    assert(Mem_Alloc(16 * 4096) == NULL);
+    ptr[3] = Mem_Alloc(30000);
+    assert(ptr[3] != NULL);
+
+    // the new memory coalesces with the old like any other block
+    for (int i = 0; i < 4; i++) assert(Mem_Free(ptr[i]) == 0);
+    assert(Mem_Fragmentation() == 0);
+    assert(Mem_Alloc(16 * 4096 - 16) != NULL);
+
+    printf("grow.c passes!\n");
+
+    exit(0);
+}
@@ -0,0 +1,94 @@
+/* compaction moves the blocks of unlocked handles and merges the free space */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define REGION (16 * 4096)
+#define SIZE 1000
+#define BIG 20000
+
+// Runs Mem_Dump and returns the total payload it prints
+int dump_payload() {
+    char line[256];
+    int payload = -1;
+    FILE* out = tmpfile();
+    int saved = dup(1);
+
+    fflush(stdout);
+    dup2(fileno(out), 1);
+    Mem_Dump();
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    rewind(out);
+    while (fgets(line, sizeof(line), out) != NULL) sscanf(line, "Total payload size = %d", &payload);
+    fclose(out);
+    return payload;
+}
+
+int main() {
+    MEM_HANDLE handle[REGION / SIZE];
+    MEM_STATS before;
+    MEM_STATS st;
+    int n;
+
+    assert(Mem_Init(REGION, FIRST_FIT) == 0);
+    assert(Mem_Lock(0) == NULL && Mem_Lock(12345) == NULL);
+
+    // fill the heap, plain blocks and slabs stay where they are
+    void* fixed = Mem_Alloc(SIZE);
+    void* small = Mem_Alloc(16);
+    assert(fixed != NULL && small != NULL);
+    for (n = 0; (handle[n] = Mem_Alloc_Handle(SIZE)) != 0; n++) {
+        char* p = Mem_Lock(handle[n]);
+        memset(p, n, SIZE);
+        assert(Mem_Unlock(handle[n]) == 0);
+    }
+    assert(n > 40);
+    assert(Mem_Unlock(handle[0]) == -1);
+
+    // every other one freed leaves plenty of space, none of it in one piece
+    for (int i = 0; i < n; i += 2) assert(Mem_Free_Handle(handle[i]) == 0);
+    assert(Mem_Free_Handle(handle[0]) == -1);
+    assert(Mem_Alloc(BIG) == NULL);
+
+    // a handle counts the bytes asked for, the granule that keeps the handle is padding
+    assert(Mem_Get_Stats(&before) == 0);
+    MEM_HANDLE extra = Mem_Alloc_Handle(SIZE);
+    assert(extra != 0 && Mem_Get_Stats(&st) == 0);
+    assert(st.bytes_in_use == before.bytes_in_use + SIZE);
+    assert(dump_payload() == st.bytes_in_use);
+    assert(Mem_Free_Handle(extra) == 0);
+
+    // a locked handle stays put and cannot be freed
+    char* pinned = Mem_Lock(handle[n - 1]);
+    assert(pinned != NULL && Mem_Lock(handle[n - 1]) == pinned);
+    assert(Mem_Free_Handle(handle[n - 1]) == -1);
+
+    assert(Mem_Compact() > 0);
+    assert(Mem_Lock(handle[n - 1]) == pinned);
+    for (int i = 0; i < 3; i++) assert(Mem_Unlock(handle[n - 1]) == 0);
+
+    // the freed space is one block now
+    void* big = Mem_Alloc(BIG);
+    assert(big != NULL);
+    for (int i = 1; i < n; i += 2) {
+        char* p = Mem_Lock(handle[i]);
+        assert(p != NULL);
+        for (int j = 0; j < SIZE; j++) assert(p[j] == (char)i);
+        assert(Mem_Unlock(handle[i]) == 0);
+        assert(Mem_Free_Handle(handle[i]) == 0);
+    }
+    assert(Mem_Free(big) == 0 && Mem_Free(small) == 0 && Mem_Free(fixed) == 0);
+    Mem_Cache_Flush();
+
+    // only the handle table is left, at the start of the heap
+    assert(Mem_Compact() == 1);
+    assert(Mem_Get_Stats(&st) == 0 && st.free_blocks == 1 && st.used_blocks == 1);
+    printf("handles.c passes!\n");
+    exit(0);
+}
@@ -0,0 +1,86 @@
+/* a heap kept in a file is reattached with its objects after it is closed */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define REGION (16 * 4096)
+#define PATH "heap_file.dat"
+#define COUNT 100
+
+// Objects refer to each other by their distance from the root, addresses change between opens
+typedef struct ROOT {
+    int count;
+    long blocks[COUNT];
+} ROOT;
+
+char* block(ROOT* root, int i) { return (char*)root + root->blocks[i]; }
+
+int main() {
+    MEM_STATS st;
+    unlink(PATH);
+
+    assert(Mem_Init_File(PATH, REGION, TLSF) == 0);
+    assert(Mem_Get_Root() == NULL);
+    ROOT* root = Mem_Alloc(sizeof(ROOT));
+    assert(root != NULL && Mem_Set_Root(root) == 0);
+    assert(Mem_Set_Root(&st) == -1);
+    root->count = COUNT;
+    for (int i = 0; i < COUNT; i++) {
+        // small objects, blocks and blocks past the mmap threshold all stay in the file
+        int size = i % 3 == 0 ? 16 : i % 3 == 1 ? 1000 : 3000;
+        char* p = Mem_Alloc(i == 50 ? 200000 : size);
+        if (p == NULL) {
+            assert(Mem_Set_Max_Size(16 * REGION) == 0);
+            p = Mem_Alloc(i == 50 ? 200000 : size);
+        }
+        assert(p != NULL);
+        memset(p, i, 16);
+        root->blocks[i] = p - (char*)root;
+    }
+    assert(Mem_Set_Mmap_Threshold(4096) == -1);
+    assert(Mem_Get_Stats(&st) == 0 && st.mapped_size == 0 && st.heap_size > REGION);
+
+    // one process at a time
+    assert(Mem_Arena_Open_File(PATH, REGION, TLSF) == NULL);
+    assert(Mem_Close() == 0);
+    assert(Mem_Close() == -1);
+
+    // reopen, the sizes given are ignored
+    assert(Mem_Init_File(PATH, 4096, BEST_FIT) == 0);
+    root = Mem_Get_Root();
+    assert(root != NULL && root->count == COUNT);
+    for (int i = 0; i < COUNT; i++) {
+        assert(block(root, i)[0] == i && block(root, i)[15] == i);
+        if (i % 2 == 0) assert(Mem_Free(block(root, i)) == 0);
+    }
+    assert(Mem_Free(block(root, 0)) == -1);
+    assert(Mem_Get_Stats(&st) == 0 && st.used_blocks == COUNT / 2 + 1);
+    assert(Mem_Alloc(5000) != NULL);
+
+    // a process that dies with the file open leaves it dirty
+    assert(Mem_Close() == 0);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (Mem_Init_File(PATH, REGION, TLSF) != 0) _exit(1);
+        Mem_Alloc(100);
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(Mem_Init_File(PATH, REGION, TLSF) == -1);
+
+    // not a heap file at all
+    FILE* f = fopen(PATH, "w");
+    fprintf(f, "not a heap\n");
+    fclose(f);
+    assert(Mem_Arena_Open_File(PATH, REGION, TLSF) == NULL);
+
+    unlink(PATH);
+    printf("heap_file.c passes!\n");
+    exit(0);
+}
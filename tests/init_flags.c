@@ -0,0 +1,67 @@
+/* the heap can be mapped anonymously, prefaulted, locked and backed by huge pages */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "mem.h"
+
+#define REGION (256 * 4096)
+#define COUNT 1000
+
+int main() {
+    int flags = MEM_MAP_ANONYMOUS | MEM_MAP_POPULATE | MEM_MAP_THP | MEM_MAP_LOCK;
+    char* ptr[COUNT];
+
+    assert(Mem_Init_Flags(REGION, BEST_FIT, 64) == -1);
+    assert(Mem_Init_Flags(0, BEST_FIT, 0) == -1);
+    assert(Mem_Init_Flags(REGION, BEST_FIT, flags) == 0);
+    assert(Mem_Init_Flags(REGION, BEST_FIT, flags) == -1);
+    assert(Mem_Init(REGION, BEST_FIT) == -1);
+
+    // more than the initial heap, the memory it grows by is mapped with the same flags
+    assert(Mem_Set_Max_Size(4 * REGION) == 0);
+    for (int i = 0; i < COUNT; i++) {
+        ptr[i] = Mem_Alloc(2000);
+        assert(ptr[i] != NULL);
+        memset(ptr[i], i, 2000);
+    }
+    for (int i = 0; i < COUNT; i++) {
+        assert(ptr[i][0] == (char)i && ptr[i][1999] == (char)i);
+        assert(Mem_Free(ptr[i]) == 0);
+    }
+
+    // unknown flags are refused
+    assert(Mem_Arena_Create_Flags(REGION, TLSF, 1 << 10) == NULL);
+    assert(Mem_Arena_Create_Flags(REGION, TLSF, 0) != NULL);
+
+    // explicit huge pages only work when some are reserved
+    MEM_ARENA* huge = Mem_Arena_Create_Flags(REGION, FIRST_FIT, MEM_MAP_HUGETLB);
+    if (huge == NULL) {
+        printf("no huge pages reserved, skipping MEM_MAP_HUGETLB\n");
+    } else {
+        char* p = Mem_Arena_Alloc(huge, 100000);
+        assert(p != NULL);
+        memset(p, 1, 100000);
+        assert(Mem_Arena_Free(huge, p) == 0);
+        assert(Mem_Arena_Destroy(huge) == 0);
+    }
+
+    // anonymous heaps open no file, not even to create or grow them
+    struct rlimit limit;
+    struct rlimit none = {0, 0};
+    assert(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+    none.rlim_max = limit.rlim_max;
+    assert(setrlimit(RLIMIT_NOFILE, &none) == 0);
+    assert(Mem_Arena_Create_Flags(REGION, TLSF, 0) == NULL);
+    MEM_ARENA* anonymous = Mem_Arena_Create_Flags(REGION, TLSF, MEM_MAP_ANONYMOUS);
+    assert(anonymous != NULL);
+    assert(Mem_Arena_Set_Max_Size(anonymous, 64 * REGION) == 0);
+    assert(Mem_Arena_Set_Mmap_Threshold(anonymous, 0) == 0);
+    assert(Mem_Arena_Alloc(anonymous, 16 * REGION) != NULL);
+    assert(setrlimit(RLIMIT_NOFILE, &limit) == 0);
+    printf("init_flags.c passes!\n");
+    exit(0);
+}
@@ -0,0 +1,43 @@
+/* large allocations get a mapping of their own */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+int main() {
+    assert(Mem_Init(4096, FIRST_FIT) == 0);
+    char* small = Mem_Alloc(100);
+    assert(small != NULL);
+
+    // far bigger than the heap, it never touches the block list
+    char* big = Mem_Alloc(1 << 20);
+    assert(big != NULL);
+    assert((uintptr_t)big % 8 == 0);
+    memset(big, 'x', 1 << 20);
+    assert(Mem_Fragmentation() == 0);
+    Mem_Dump();
+
+    // interior pointers and double frees are still caught
+    assert(Mem_Free(big + 8) == -1);
+    assert(Mem_Free(big) == 0);
+    assert(Mem_Free(big) == -1);
+
+    // a lower threshold moves smaller requests out of the heap, 0 turns it off
+    assert(Mem_Set_Mmap_Threshold(-1) == -1);
+    assert(Mem_Set_Mmap_Threshold(1000) == 0);
+    big = Mem_Alloc(3000);
+    assert(big != NULL);
+    assert(Mem_Alloc(3900) != NULL);
+    assert(Mem_Free(big) == 0);
+    assert(Mem_Set_Mmap_Threshold(0) == 0);
+    assert(Mem_Alloc(1 << 20) == NULL);
+
+    assert(Mem_Free(small) == 0);
+
+    printf("mmap_large.c passes!\n");
+
+    exit(0);
+}
@@ -0,0 +1,62 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mem.h"
+
+int main() {
+    assert(Mem_Init(4096, NEXT_FIT) == 0);
+    void* ptr[9];
+    void* test;
+
+    ptr[0] = Mem_Alloc(300);
+    assert(ptr[0] != NULL);
+
+    ptr[1] = Mem_Alloc(200);
+    assert(ptr[1] != NULL);
+
+    ptr[2] = Mem_Alloc(200);
+    assert(ptr[2] != NULL);
+
+    ptr[3] = Mem_Alloc(100);
+    assert(ptr[3] != NULL);
+
+    ptr[4] = Mem_Alloc(200);
+    assert(ptr[4] != NULL);
+
+    ptr[5] = Mem_Alloc(800);
+    assert(ptr[5] != NULL);
+
+    ptr[6] = Mem_Alloc(500);
+    assert(ptr[6] != NULL);
+
+    ptr[7] = Mem_Alloc(700);
+    assert(ptr[7] != NULL);
+
+    ptr[8] = Mem_Alloc(300);
+    assert(ptr[8] != NULL);
+
+    assert(Mem_Free(ptr[1]) == 0);
+
+    assert(Mem_Free(ptr[3]) == 0);
+
+    assert(Mem_Free(ptr[5]) == 0);
+
+    assert(Mem_Free(ptr[7]) == 0);
+
+    // the search picks up after the last allocation, at the end of the heap
+    test = Mem_Alloc(50);
+    assert(test > ptr[8]);
+
+    // too big for what is left at the end, wraps around to the first hole that fits
+    test = Mem_Alloc(700);
+    assert(test == ptr[5]);
+
+    // continues from there instead of going back to the 200 byte hole
+    test = Mem_Alloc(100);
+    assert(test == ptr[7]);
+
+    printf("nextfit.c passes!\n");
+
+    exit(0);
+}
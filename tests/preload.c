@@ -0,0 +1,72 @@
+/* the preload shim serves malloc and friends from libmem */
+#include <assert.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS 4
+#define COUNT 1000
+
+void* worker(void* arg) {
+    char* ptr[COUNT];
+
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < COUNT; i++) {
+            ptr[i] = malloc(i % 300 + 1);
+            assert(ptr[i] != NULL && (uintptr_t)ptr[i] % 16 == 0);
+            ptr[i][0] = (char)i;
+        }
+        for (int i = 0; i < COUNT; i++) {
+            assert(ptr[i][0] == (char)i);
+            free(ptr[i]);
+        }
+    }
+    return arg;
+}
+
+int main() {
+    // small objects come from 16 byte slab classes, glibc would have 24 usable bytes
+    char* a = malloc(1);
+    assert(a != NULL && malloc_usable_size(a) == 16);
+    free(a);
+
+    // malloc alignment holds for blocks of the heap too
+    for (int size = 1; size < 5000; size += 37) {
+        char* p = malloc(size);
+        assert(p != NULL && (uintptr_t)p % 16 == 0 && malloc_usable_size(p) >= (size_t)size);
+        memset(p, 1, size);
+        free(p);
+    }
+
+    int* z = calloc(1000, sizeof(int));
+    for (int i = 0; i < 1000; i++) assert(z[i] == 0);
+    volatile size_t huge = SIZE_MAX / 2;
+    assert(calloc(huge, 4) == NULL && errno == ENOMEM);
+
+    char* r = NULL;
+    for (int size = 1; size < 100000; size = size * 3 / 2 + 1) {
+        r = realloc(r, size);
+        assert(r != NULL && (uintptr_t)r % 16 == 0);
+        r[size - 1] = 'r';
+        assert(size < 4 || r[size * 2 / 3 - 1] == 'r');
+    }
+    free(r);
+    free(z);
+
+    void* aligned;
+    assert(posix_memalign(&aligned, 4096, 100) == 0 && (uintptr_t)aligned % 4096 == 0);
+    free(aligned);
+    assert(posix_memalign(&aligned, 24, 100) == EINVAL);
+
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++) pthread_create(&threads[i], NULL, worker, NULL);
+    for (int i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+
+    printf("preload.c passes!\n");
+
+    exit(0);
+}
@@ -0,0 +1,102 @@
+/* the heap profiler samples allocations by backtrace and writes a pprof heap profile */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+#define COUNT 2000
+#define SIZE 100
+#define RATE 1024
+
+void *ptrs[COUNT];
+
+// Dumps the profile and reads its totals back, returns the number of backtrace lines
+int read_profile(long long *live, long long *live_bytes, long long *total) {
+    char line[4096];
+    long long total_bytes;
+    int rate;
+    int stacks = 0;
+    FILE *file = tmpfile();
+
+    assert(file != NULL && Mem_Profile_Dump(fileno(file)) == 0);
+    rewind(file);
+    assert(fgets(line, sizeof(line), file) != NULL);
+    assert(sscanf(line, "heap profile: %lld: %lld [%lld: %lld] @ heap_v2/%d", live, live_bytes,
+                  total, &total_bytes, &rate) == 5);
+    while (fgets(line, sizeof(line), file) != NULL && line[0] != '\n') {
+        assert(strstr(line, "] @ 0x") != NULL);
+        stacks++;
+    }
+    assert(fgets(line, sizeof(line), file) != NULL && strcmp(line, "MAPPED_LIBRARIES:\n") == 0);
+    fclose(file);
+    return stacks;
+}
+
+int main() {
+    long long live, live_bytes, total;
+    MEM_HANDLE first, second;
+    FILE *file;
+    void *ptr;
+    int i;
+
+    assert(Mem_Init(4 * COUNT * SIZE, BEST_FIT) == 0);
+    assert(Mem_Set_Profile_Rate(-1) == -1);
+
+    // Off by default, nothing is sampled and there is nothing to dump
+    for (i = 0; i < COUNT; i++) assert((ptrs[i] = Mem_Alloc(SIZE)) != NULL);
+    assert((file = tmpfile()) != NULL && Mem_Profile_Dump(fileno(file)) == -1);
+    assert(ftell(file) == 0 && fgetc(file) == EOF);
+    fclose(file);
+    for (i = 0; i < COUNT; i++) assert(Mem_Free(ptrs[i]) == 0);
+
+    // About one block in ten is sampled, all of them from the same place
+    assert(Mem_Set_Profile_Rate(RATE) == 0);
+    for (i = 0; i < COUNT; i++) assert((ptrs[i] = Mem_Alloc(SIZE)) != NULL);
+    assert(read_profile(&live, &live_bytes, &total) >= 1);
+    assert(live > COUNT / 20 && live < COUNT / 5);
+    assert(live_bytes == live * SIZE && total == live);
+
+    // Freed blocks leave the live totals, they still count as allocated
+    for (i = 0; i < COUNT; i += 2) assert(Mem_Free(ptrs[i]) == 0);
+    read_profile(&live, &live_bytes, &total);
+    assert(live < total && live > 0);
+
+    for (i = 1; i < COUNT; i += 2) assert(Mem_Free(ptrs[i]) == 0);
+    read_profile(&live, &live_bytes, &total);
+    assert(live == 0 && live_bytes == 0 && total > 0);
+
+    // With a rate of one byte every allocation is sampled, blocks of handles included
+    assert(Mem_Set_Profile_Rate(1) == 0);
+    for (i = 0; i < COUNT; i++) assert(Mem_Free(Mem_Alloc(SIZE)) == 0);
+    assert((first = Mem_Alloc_Handle(SIZE)) != 0 && (second = Mem_Alloc_Handle(2 * SIZE)) != 0);
+    read_profile(&live, &live_bytes, &total);
+    assert(live == 2 && live_bytes == 3 * SIZE);
+
+    // The sample of a handle follows its block when compaction moves it
+    assert(Mem_Free_Handle(first) == 0 && Mem_Compact() == 1);
+    assert(Mem_Free_Handle(second) == 0);
+    read_profile(&live, &live_bytes, &total);
+    assert(live == 0 && live_bytes == 0);
+
+    // A block resized in place keeps its sample, with the new size
+    assert((ptr = Mem_Alloc(4 * SIZE)) != NULL && Mem_Realloc(ptr, SIZE) == ptr);
+    read_profile(&live, &live_bytes, &total);
+    assert(live == 1 && live_bytes == SIZE);
+
+    // A free that fails leaves the sample alone
+    MEM_ARENA *other = Mem_Arena_Create(4 * SIZE * 64, BEST_FIT);
+    assert(other != NULL && Mem_Arena_Free(other, ptr) == -1);
+    read_profile(&live, &live_bytes, &total);
+    assert(live == 1 && live_bytes == SIZE);
+    assert(Mem_Arena_Destroy(other) == 0);
+    assert(Mem_Free(ptr) == 0);
+
+    assert(Mem_Set_Profile_Rate(0) == 0);
+    assert((file = tmpfile()) != NULL && Mem_Profile_Dump(fileno(file)) == -1);
+    assert(ftell(file) == 0);
+    fclose(file);
+    printf("profile.c passes!\n");
+    return 0;
+}
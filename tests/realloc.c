@@ -0,0 +1,65 @@
+/* realloc grows and shrinks blocks in place and copies only when it must */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+#define REGION 4096
+
+int main() {
+    assert(Mem_Init(REGION, FIRST_FIT) == 0);
+
+    // grows into the free space behind it
+    char* a = Mem_Alloc(100);
+    assert(a != NULL);
+    memset(a, 'a', 100);
+    assert(Mem_Realloc(a, 1000) == a);
+    for (int i = 0; i < 100; i++) assert(a[i] == 'a');
+    memset(a, 'a', 1000);
+
+    // shrinks in place, the tail is free again
+    assert(Mem_Realloc(a, 200) == a);
+    char* b = Mem_Alloc(500);
+    assert(b != NULL && b > a && b < a + 1000);
+
+    // a neighbour in the way forces a copy
+    char* c = Mem_Realloc(a, 800);
+    assert(c != NULL && c != a);
+    for (int i = 0; i < 200; i++) assert(c[i] == 'a');
+    assert(Mem_Free(a) == -1);
+
+    // small objects stay put while they fit their class
+    char* d = Mem_Alloc(10);
+    assert(Mem_Realloc(d, 16) == d);
+    strcpy(d, "realloc");
+    char* e = Mem_Realloc(d, 40);
+    assert(e != NULL && strcmp(e, "realloc") == 0);
+
+    // NULL allocates, 0 frees, bad pointers are refused
+    char* f = Mem_Realloc(NULL, 30);
+    assert(f != NULL);
+    assert(Mem_Realloc(f, 0) == NULL);
+    assert(Mem_Free(f) == -1);
+    assert(Mem_Realloc(b + 8, 100) == NULL);
+
+    // large blocks are remapped, not copied by hand
+    char* g = Mem_Alloc(200000);
+    assert(g != NULL);
+    memset(g, 'g', 200000);
+    g = Mem_Realloc(g, 1000000);
+    assert(g != NULL && g[199999] == 'g');
+    g = Mem_Realloc(g, 150000);
+    assert(g != NULL && g[149999] == 'g');
+    Mem_Dump();
+
+    assert(Mem_Free(b) == 0);
+    assert(Mem_Free(c) == 0);
+    assert(Mem_Free(e) == 0);
+    assert(Mem_Free(g) == 0);
+
+    printf("realloc.c passes!\n");
+
+    exit(0);
+}
@@ -0,0 +1,118 @@
+/* a region hands out objects by bumping a pointer and frees them all at once */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define REGION (64 * 4096)
+#define CHUNK 4096
+#define PATH "region.dat"
+#define COUNT 100
+
+// The region and its objects by their distance from the root, addresses change between opens
+typedef struct ROOT {
+    long region;
+    long objects[COUNT];
+} ROOT;
+
+int main() {
+    MEM_STATS before;
+    MEM_STATS st;
+    char *p[1000];
+    int i;
+
+    assert(Mem_Init(REGION, BEST_FIT) == 0);
+    assert(Mem_Region_Create(-1) == NULL);
+    assert(Mem_Region_Alloc(NULL, 8) == NULL);
+    assert(Mem_Region_Destroy(NULL) == -1);
+    assert(Mem_Get_Stats(&before) == 0);
+
+    MEM_REGION *region = Mem_Region_Create(CHUNK);
+    assert(region != NULL);
+    assert(Mem_Region_Alloc(region, 0) == NULL);
+
+    // Objects are packed back to back, 8 byte aligned, and keep their contents
+    char *a = Mem_Region_Alloc(region, 5);
+    char *b = Mem_Region_Alloc(region, 16);
+    assert(a != NULL && b == a + 8 && (uintptr_t)a % 8 == 0);
+    for (i = 0; i < 1000; i++) {
+        assert((p[i] = Mem_Region_Alloc(region, 100)) != NULL);
+        memset(p[i], i, 100);
+    }
+    for (i = 0; i < 1000; i++) assert(p[i][0] == (char)i && p[i][99] == (char)i);
+
+    // A big object gets a chunk of its own, the chunk being filled carries on after it
+    char *c = Mem_Region_Alloc(region, 3000);
+    char *d = Mem_Region_Alloc(region, 8);
+    assert(c != NULL && d == p[999] + 104);
+    memset(c, 1, 3000);
+
+    // The chunks are ordinary blocks of the heap
+    assert(Mem_Get_Stats(&st) == 0);
+    assert(st.used_blocks > before.used_blocks + 20);
+    assert(Mem_Free(a) == -1);
+
+    // A reset keeps the first chunk and starts over at its beginning
+    Mem_Region_Reset(region);
+    assert(Mem_Get_Stats(&st) == 0);
+    assert(st.used_blocks == before.used_blocks + 1);
+    assert(Mem_Region_Alloc(region, 5) == a);
+
+    // Over and over, a reset region does not grow the heap
+    for (int round = 0; round < 100; round++) {
+        for (i = 0; i < 200; i++) assert(Mem_Region_Alloc(region, 1 + rand() % 500) != NULL);
+        Mem_Region_Reset(region);
+    }
+    assert(Mem_Get_Stats(&st) == 0);
+    assert(st.heap_size == before.heap_size && st.used_blocks == before.used_blocks + 1);
+
+    // Chunks stay in the heap whatever the mmap threshold, big objects and new chunks alike
+    assert(Mem_Set_Mmap_Threshold(1024) == 0);
+    assert(Mem_Region_Alloc(region, 3000) == a && Mem_Region_Alloc(region, 5000) != NULL);
+    assert(Mem_Region_Alloc(region, 1000) == a + 3000 && Mem_Region_Alloc(region, 1000) != NULL);
+    assert(Mem_Get_Stats(&st) == 0);
+    assert(st.mapped_size == 0 && st.used_blocks == before.used_blocks + 3);
+    Mem_Region_Reset(region);
+    assert(Mem_Set_Mmap_Threshold(0) == 0);
+
+    assert(Mem_Region_Destroy(region) == 0);
+    assert(Mem_Get_Stats(&st) == 0);
+    assert(st.used_blocks == before.used_blocks && st.free_blocks == 1);
+
+    // A region of a heap file carries on once the file is open again, wherever it is mapped
+    unlink(PATH);
+    MEM_ARENA *file = Mem_Arena_Open_File(PATH, REGION, BEST_FIT);
+    ROOT *root = Mem_Arena_Alloc(file, sizeof(ROOT));
+    assert(root != NULL && Mem_Arena_Set_Root(file, root) == 0);
+    assert((region = Mem_Arena_Create_Region(file, CHUNK)) != NULL);
+    root->region = (char *)region - (char *)root;
+    for (i = 0; i < COUNT; i++) {
+        char *q = Mem_Region_Alloc(region, 200);
+        assert(q != NULL);
+        memset(q, i, 200);
+        root->objects[i] = q - (char *)root;
+    }
+    assert(Mem_Arena_Destroy(file) == 0);
+
+    MEM_ARENA *other = Mem_Arena_Create(REGION, BEST_FIT);
+    assert(other != NULL && (file = Mem_Arena_Open_File(PATH, 0, BEST_FIT)) != NULL);
+    root = Mem_Arena_Get_Root(file);
+    region = (MEM_REGION *)((char *)root + root->region);
+    for (i = 0; i < COUNT; i++) {
+        char *q = (char *)root + root->objects[i];
+        assert(q[0] == (char)i && q[199] == (char)i);
+    }
+    for (i = 0; i < COUNT; i++) assert(Mem_Region_Alloc(region, 200) != NULL);
+    Mem_Region_Reset(region);
+    assert(Mem_Arena_Get_Stats(file, &st) == 0 && st.used_blocks == 2);
+    assert(Mem_Region_Destroy(region) == 0);
+    assert(Mem_Arena_Get_Stats(file, &st) == 0 && st.used_blocks == 1);
+    assert(Mem_Arena_Destroy(file) == 0 && Mem_Arena_Destroy(other) == 0);
+    unlink(PATH);
+    printf("region.c passes!\n");
+    return 0;
+}
@@ -0,0 +1,85 @@
+/* blocks allocated by one thread are freed by others without waiting for the lock */
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define FREERS 3
+#define BLOCKS 30000
+#define REGION (1 << 20)
+
+int pipes[2];
+
+// Frees whatever the allocating thread hands over, checking nobody wrote to it
+void* freer(void* arg) {
+    unsigned char* ptr;
+
+    while (read(pipes[0], &ptr, sizeof(ptr)) == sizeof(ptr)) {
+        if (ptr == NULL) break;
+        int size = ptr[0] * 8 + 65;
+        for (int j = 1; j < size; j++) assert(ptr[j] == ptr[0]);
+        assert(Mem_Free(ptr) == 0);
+    }
+    return NULL;
+}
+
+// Frees small objects, which pass through the thread cache, and large blocks alike
+void* mixed_freer(void* arg) {
+    void* ptr;
+
+    while (read(pipes[0], &ptr, sizeof(ptr)) == sizeof(ptr) && ptr != NULL)
+        assert(Mem_Free(ptr) == 0);
+    Mem_Cache_Flush();
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[FREERS];
+    MEM_STATS st;
+    unsigned char* ptr;
+
+    assert(Mem_Init(REGION, TLSF) == 0);
+    assert(pipe(pipes) == 0);
+    for (long i = 0; i < FREERS; i++) assert(pthread_create(&threads[i], NULL, freer, NULL) == 0);
+
+    // allocations keep the lock busy while the freers hand the blocks back
+    for (int i = 0; i < BLOCKS; i++) {
+        int n = i % 100;
+        while ((ptr = Mem_Alloc(n * 8 + 65)) == NULL) sched_yield();
+        memset(ptr, n, n * 8 + 65);
+        assert(write(pipes[1], &ptr, sizeof(ptr)) == sizeof(ptr));
+    }
+    ptr = NULL;
+    for (int i = 0; i < FREERS; i++) assert(write(pipes[1], &ptr, sizeof(ptr)) == sizeof(ptr));
+    for (int i = 0; i < FREERS; i++) assert(pthread_join(threads[i], NULL) == 0);
+
+    // whatever is still queued is freed and coalesced on the next locked call
+    assert(Mem_Get_Stats(&st) == 0);
+    assert(st.used_blocks == 0 && st.free_blocks == 1);
+    assert(st.alloc_count == BLOCKS && st.free_count == BLOCKS);
+    assert((ptr = Mem_Alloc(REGION - 16)) != NULL && Mem_Free(ptr) == 0);
+
+    // cache flushes and large frees do not wait for the lock either
+    assert(Mem_Set_Mmap_Threshold(8192) == 0);
+    for (long i = 0; i < FREERS; i++)
+        assert(pthread_create(&threads[i], NULL, mixed_freer, NULL) == 0);
+    for (int i = 0; i < BLOCKS; i++) {
+        int size = i % 16 == 0 ? 16384 : 32;
+        while ((ptr = Mem_Alloc(size)) == NULL) sched_yield();
+        memset(ptr, i, size);
+        assert(write(pipes[1], &ptr, sizeof(ptr)) == sizeof(ptr));
+    }
+    ptr = NULL;
+    for (int i = 0; i < FREERS; i++) assert(write(pipes[1], &ptr, sizeof(ptr)) == sizeof(ptr));
+    for (int i = 0; i < FREERS; i++) assert(pthread_join(threads[i], NULL) == 0);
+
+    assert(Mem_Get_Stats(&st) == 0);
+    assert(st.used_blocks == 0 && st.mapped_size == 0);
+    assert(st.alloc_count == 2 * BLOCKS + 1 && st.free_count == 2 * BLOCKS + 1);
+    printf("remote_free.c passes!\n");
+    exit(0);
+}
@@ -9,3 +9,28 @@
 ./mem_free         
 ./coalesce 
 ./firstfit      
+./bestfit
+./worstfit
+./nextfit
+./tlsf
+./badfree
+./threads
+./arenas
+./grow
+./mmap_large
+./slab
+./aligned
+./realloc
+./batch
+./stats
+LD_PRELOAD=../libmempreload.so ./preload
+LD_PRELOAD=../libmempreload.so ./fork
+./init_flags
+./heap_file
+./shared
+./remote_free
+./deferred
+./handles
+./profile
+./snapshot
+./region
@@ -0,0 +1,96 @@
+/* processes share an arena and hand buffers to each other by offset */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define REGION (16 * 4096)
+#define NAME "/libmem_shared_test"
+#define WORKERS 4
+#define ROUNDS 2000
+
+// Allocates and frees in a loop while the other workers do the same, then hands one buffer back
+void worker(MEM_ARENA* arena, int id, int out) {
+    char* ptr[64] = {0};
+    int size[64] = {0};
+
+    srand(id);
+    for (int i = 0; i < ROUNDS; i++) {
+        int k = rand() % 64;
+        if (ptr[k] != NULL) {
+            for (int j = 0; j < size[k]; j++) assert(ptr[k][j] == (char)(id + k));
+            assert(Mem_Arena_Free(arena, ptr[k]) == 0);
+        }
+        size[k] = rand() % 3000 + 1;
+        ptr[k] = Mem_Arena_Alloc(arena, size[k]);
+        assert(ptr[k] != NULL);
+        memset(ptr[k], id + k, size[k]);
+    }
+    for (int k = 0; k < 64; k++) assert(Mem_Arena_Free(arena, ptr[k]) == 0);
+
+    char* buffer = Mem_Arena_Alloc(arena, 1000);
+    assert(buffer != NULL);
+    memset(buffer, id, 1000);
+    unsigned offset = Mem_Arena_Offset(arena, buffer);
+    assert(write(out, &offset, sizeof(offset)) == sizeof(offset));
+}
+
+int main() {
+    MEM_STATS st;
+    int pipes[2];
+    unsigned offset;
+    int status;
+
+    // anonymous memory shared with forked children, which allocate at the same time
+    MEM_ARENA* arena = Mem_Arena_Create_Shared(NULL, REGION, TLSF);
+    assert(arena != NULL);
+    assert(Mem_Arena_Set_Max_Size(arena, 64 * REGION) == 0);
+    assert(pipe(pipes) == 0);
+    for (int id = 0; id < WORKERS; id++) {
+        if (fork() == 0) {
+            worker(arena, id + 1, pipes[1]);
+            _exit(0);
+        }
+    }
+    for (int id = 0; id < WORKERS; id++) {
+        assert(read(pipes[0], &offset, sizeof(offset)) == sizeof(offset));
+        char* buffer = Mem_Arena_Pointer(arena, offset);
+        assert(buffer != NULL && buffer[0] >= 1 && buffer[0] <= WORKERS);
+        for (int j = 0; j < 1000; j++) assert(buffer[j] == buffer[0]);
+        assert(Mem_Arena_Free(arena, buffer) == 0);
+    }
+    while (wait(&status) > 0) assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(Mem_Arena_Get_Stats(arena, &st) == 0);
+    assert(st.used_blocks == 0 && st.alloc_count == WORKERS * (ROUNDS + 1));
+    assert(Mem_Arena_Pointer(arena, 0) == NULL && Mem_Arena_Offset(arena, &st) == 0);
+    assert(Mem_Arena_Destroy(arena) == 0);
+
+    // a named arena another process attaches to
+    shm_unlink(NAME);
+    arena = Mem_Arena_Create_Shared(NAME, REGION, BEST_FIT);
+    assert(arena != NULL);
+    assert(Mem_Arena_Create_Shared(NAME, REGION, BEST_FIT) == NULL);
+    char* buffer = Mem_Arena_Alloc(arena, 5000);
+    assert(buffer != NULL);
+    offset = Mem_Arena_Offset(arena, buffer);
+    if (fork() == 0) {
+        MEM_ARENA* other = Mem_Arena_Open_Shared(NAME);
+        if (other == NULL || other == arena) _exit(1);
+        memset(Mem_Arena_Pointer(other, offset), 7, 5000);
+        if (Mem_Arena_Alloc(other, 100) == NULL) _exit(1);
+        _exit(Mem_Arena_Destroy(other) == 0 ? 0 : 1);
+    }
+    assert(wait(&status) > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    for (int j = 0; j < 5000; j++) assert(buffer[j] == 7);
+    assert(Mem_Arena_Get_Stats(arena, &st) == 0 && st.used_blocks == 2);
+    assert(Mem_Arena_Destroy(arena) == 0);
+    assert(Mem_Arena_Open_Shared("/libmem_no_such_arena") == NULL);
+    assert(shm_unlink(NAME) == 0);
+    printf("shared.c passes!\n");
+    exit(0);
+}
@@ -0,0 +1,51 @@
+/* small objects are packed into slabs without headers */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mem.h"
+
+#define REGION (16 * 4096)
+#define COUNT 1000
+
+int main() {
+    assert(Mem_Init(REGION, FIRST_FIT) == 0);
+    char* ptr[COUNT];
+
+    // objects of one size class sit right next to each other
+    for (int i = 0; i < COUNT; i++) {
+        ptr[i] = Mem_Alloc(8);
+        assert(ptr[i] != NULL);
+        assert((uintptr_t)ptr[i] % 8 == 0);
+        *ptr[i] = i;
+    }
+    assert(ptr[1] == ptr[0] + 8);
+    assert(ptr[2] == ptr[1] + 8);
+
+    // other classes get slabs of their own
+    char* a = Mem_Alloc(17);
+    char* b = Mem_Alloc(24);
+    assert(a != NULL && b != NULL && b == a + 24);
+    Mem_Dump();
+
+    // interior pointers and double frees are caught, cached or not
+    assert(Mem_Free(a + 8) == -1);
+    assert(Mem_Free(a) == 0);
+    assert(Mem_Free(a) == -1);
+    assert(Mem_Free(b) == 0);
+    assert(Mem_Free(b) == -1);
+
+    for (int i = 0; i < COUNT; i++) {
+        assert(*ptr[i] == (char)i);
+        assert(Mem_Free(ptr[i]) == 0);
+    }
+
+    // empty slabs go back to the heap
+    Mem_Cache_Flush();
+    assert(Mem_Alloc(REGION - 16) != NULL);
+
+    printf("slab.c passes!\n");
+
+    exit(0);
+}
@@ -0,0 +1,80 @@
+/* a snapshot records every block of the heap in binary or JSON */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mem.h"
+
+#define REGION (16 * 4096)
+#define HEADER_SIZE 8  // header of a block of the heap
+
+MEM_SNAPSHOT_BLOCK blocks[1024];
+
+// Takes a binary snapshot and reads it back, returns the number of blocks
+unsigned take_snapshot(MEM_SNAPSHOT_HEADER *header) {
+    FILE *file = tmpfile();
+
+    assert(file != NULL && Mem_Snapshot(fileno(file), MEM_SNAPSHOT_BINARY) == 0);
+    rewind(file);
+    assert(fread(header, sizeof(*header), 1, file) == 1);
+    assert(header->magic == MEM_SNAPSHOT_MAGIC && header->count <= 1024);
+    assert(fread(blocks, sizeof(MEM_SNAPSHOT_BLOCK), header->count, file) == header->count);
+    assert(fgetc(file) == EOF);
+    fclose(file);
+    return header->count;
+}
+
+int main() {
+    MEM_SNAPSHOT_HEADER header;
+    MEM_STATS st;
+    char line[256];
+    unsigned count;
+    unsigned offset = 0;
+    unsigned i;
+    int lines = 0;
+    FILE *file;
+
+    assert(Mem_Snapshot(1, MEM_SNAPSHOT_BINARY) == -1);
+    assert(Mem_Init(REGION, FIRST_FIT) == 0);
+    assert(Mem_Snapshot(1, 2) == -1);
+
+    void *a = Mem_Alloc(1000);
+    void *b = Mem_Alloc(2000);
+    void *c = Mem_Alloc(3000);
+    void *d = Mem_Alloc(200000);
+    assert(a != NULL && b != NULL && c != NULL && d != NULL);
+    assert(Mem_Free(b) == 0);
+
+    // The blocks of the heap cover it end to end, the large block comes last
+    count = take_snapshot(&header);
+    assert(header.heap_size == REGION && header.mapped_size > 200000 && header.policy == FIRST_FIT);
+    assert(count == 5);
+    for (i = 0; i < count - 1; i++) {
+        assert(blocks[i].offset == offset);
+        offset += HEADER_SIZE + blocks[i].payload + blocks[i].padding;
+    }
+    assert(offset + HEADER_SIZE == REGION);
+    assert(blocks[0].status == MEM_BLOCK_BUSY && blocks[0].payload == 1000);
+    assert(blocks[1].status == MEM_BLOCK_FREE && blocks[1].padding == 0);
+    assert(blocks[2].status == MEM_BLOCK_BUSY && blocks[2].payload == 3000);
+    assert(blocks[3].status == MEM_BLOCK_FREE);
+    assert(blocks[4].status == MEM_BLOCK_MAPPED && blocks[4].payload == 200000);
+
+    assert(Mem_Get_Stats(&st) == 0);
+    assert(st.free_blocks == 2 && blocks[1].payload + blocks[3].payload == st.free_bytes);
+
+    // The JSON snapshot has a line per block between the opening and closing lines
+    assert((file = tmpfile()) != NULL);
+    assert(Mem_Snapshot(fileno(file), MEM_SNAPSHOT_JSON) == 0);
+    rewind(file);
+    while (fgets(line, sizeof(line), file) != NULL) lines++;
+    assert(lines == (int)count + 2);
+    rewind(file);
+    assert(fgets(line, sizeof(line), file) != NULL && strncmp(line, "{\"time\": ", 9) == 0);
+    assert(fgets(line, sizeof(line), file) != NULL);
+    assert(strcmp(line, "{\"offset\": 0, \"status\": \"busy\", \"payload\": 1000, "
+                        "\"padding\": 0},\n") == 0);
+    fclose(file);
+    printf("snapshot.c passes!\n");
+    return 0;
+}
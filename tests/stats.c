@@ -0,0 +1,77 @@
+/* running statistics follow every allocation and free */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mem.h"
+
+#define REGION (16 * 4096)
+
+void check_sum(MEM_STATS* st) {
+    assert(st->bytes_in_use + st->padding_bytes + st->header_bytes + st->free_bytes ==
+           st->heap_size + st->mapped_size);
+}
+
+int main() {
+    MEM_STATS st;
+    assert(Mem_Get_Stats(&st) == -1);
+    assert(Mem_Init(REGION, TLSF) == 0);
+
+    // one free block spanning the heap
+    assert(Mem_Get_Stats(&st) == 0);
+    check_sum(&st);
+    assert(st.heap_size == REGION && st.bytes_in_use == 0 && st.used_blocks == 0);
+    assert(st.free_blocks == 1 && st.largest_free <= st.free_bytes);
+    assert(st.largest_free * 2 > st.free_bytes);
+
+    void* a = Mem_Alloc(1001);
+    void* b = Mem_Alloc(20);
+    void* c = Mem_Alloc(200000);
+    assert(a != NULL && b != NULL && c != NULL);
+    assert(Mem_Alloc(100000) == NULL);
+    assert(Mem_Get_Stats(&st) == 0);
+    check_sum(&st);
+    assert(st.bytes_in_use == 1001 + 24 + 200000);
+    assert(st.used_blocks == 3);
+    assert(st.padding_bytes >= 7 && st.mapped_size >= 200000);
+    assert(st.alloc_count == 3 && st.free_count == 0 && st.failed_allocs == 1);
+
+    assert(Mem_Free(a) == 0);
+    assert(Mem_Free(a) == -1);
+    assert(Mem_Free(c) == 0);
+    assert(Mem_Get_Stats(&st) == 0);
+    check_sum(&st);
+    assert(st.bytes_in_use == 24 && st.used_blocks == 1 && st.mapped_size == 0);
+    assert(st.alloc_count == 3 && st.free_count == 2);
+
+    // the cached object still counts until the cache is flushed
+    assert(Mem_Free(b) == 0);
+    Mem_Cache_Flush();
+    assert(Mem_Get_Stats(&st) == 0);
+    check_sum(&st);
+    assert(st.bytes_in_use == 0 && st.used_blocks == 0 && st.free_blocks == 1);
+    assert(st.free_count == 3);
+
+    // the largest free block is exact whatever the policy
+    for (int policy = BEST_FIT; policy <= TLSF; policy++) {
+        MEM_ARENA* arena = Mem_Arena_Create(REGION, policy);
+        void* blocks[6];
+        int sizes[6] = {3000, 100, 5000, 100, 1704, 100};
+
+        assert(arena != NULL);
+        for (int i = 0; i < 6; i++) assert((blocks[i] = Mem_Arena_Alloc(arena, sizes[i])) != NULL);
+        assert(Mem_Arena_Alloc(arena, REGION - 10300) != NULL);  // what is left of the heap
+        assert(Mem_Arena_Free(arena, blocks[0]) == 0);
+        assert(Mem_Arena_Free(arena, blocks[2]) == 0);
+        assert(Mem_Arena_Free(arena, blocks[4]) == 0);
+        assert(Mem_Arena_Get_Stats(arena, &st) == 0);
+        check_sum(&st);
+        assert(st.free_blocks == 4);  // the three freed and the tail left over
+        assert(st.largest_free == 5000);
+        assert(Mem_Arena_Destroy(arena) == 0);
+    }
+
+    printf("stats.c passes!\n");
+
+    exit(0);
+}
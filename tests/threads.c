@@ -0,0 +1,54 @@
+/* several threads allocate and free at the same time */
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+#define THREADS 4
+#define SLOTS 64
+#define ROUNDS 20000
+#define REGION (1 << 20)
+
+void* worker(void* arg) {
+    unsigned seed = (unsigned)(long)arg;
+    unsigned char* ptr[SLOTS] = {0};
+    int size[SLOTS];
+
+    for (int i = 0; i < ROUNDS; i++) {
+        int k = rand_r(&seed) % SLOTS;
+        if (ptr[k] != NULL) {
+            // nobody else wrote to our block
+            for (int j = 0; j < size[k]; j++) assert(ptr[k][j] == (unsigned char)(k + j));
+            assert(Mem_Free(ptr[k]) == 0);
+            ptr[k] = NULL;
+        } else {
+            // mostly small objects, some bigger ones that bypass the cache
+            size[k] = rand_r(&seed) % 8 ? rand_r(&seed) % 64 + 1 : rand_r(&seed) % 1000 + 65;
+            ptr[k] = Mem_Alloc(size[k]);
+            assert(ptr[k] != NULL);
+            for (int j = 0; j < size[k]; j++) ptr[k][j] = k + j;
+        }
+    }
+    for (int k = 0; k < SLOTS; k++)
+        if (ptr[k] != NULL) assert(Mem_Free(ptr[k]) == 0);
+    return NULL;
+}
+
+int main() {
+    assert(Mem_Init(REGION, FIRST_FIT) == 0);
+    pthread_t threads[THREADS];
+
+    for (long i = 0; i < THREADS; i++) assert(pthread_create(&threads[i], NULL, worker, (void*)i) == 0);
+    for (int i = 0; i < THREADS; i++) assert(pthread_join(threads[i], NULL) == 0);
+
+    // exiting threads hand their cached blocks back, so the heap is one free block again
+    void* all = Mem_Alloc(REGION - 16);
+    assert(all != NULL);
+
+    printf("threads.c passes!\n");
+
+    exit(0);
+}
@@ -0,0 +1,64 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mem.h"
+
+int main() {
+    assert(Mem_Init(4096, TLSF) == 0);
+    void* ptr[9];
+    void* test;
+
+    ptr[0] = Mem_Alloc(300);
+    assert(ptr[0] != NULL);
+
+    ptr[1] = Mem_Alloc(200);
+    assert(ptr[1] != NULL);
+
+    ptr[2] = Mem_Alloc(200);
+    assert(ptr[2] != NULL);
+
+    ptr[3] = Mem_Alloc(100);
+    assert(ptr[3] != NULL);
+
+    ptr[4] = Mem_Alloc(200);
+    assert(ptr[4] != NULL);
+
+    ptr[5] = Mem_Alloc(800);
+    assert(ptr[5] != NULL);
+
+    ptr[6] = Mem_Alloc(500);
+    assert(ptr[6] != NULL);
+
+    ptr[7] = Mem_Alloc(700);
+    assert(ptr[7] != NULL);
+
+    ptr[8] = Mem_Alloc(300);
+    assert(ptr[8] != NULL);
+
+    assert(Mem_Free(ptr[1]) == 0);
+
+    assert(Mem_Free(ptr[3]) == 0);
+
+    assert(Mem_Free(ptr[5]) == 0);
+
+    assert(Mem_Free(ptr[7]) == 0);
+
+    // the 100 byte hole is in the smallest size class that fits
+    test = Mem_Alloc(50);
+    assert(test == ptr[3]);
+
+    // the 200 byte hole is in the smallest size class that fits
+    test = Mem_Alloc(150);
+    assert(test == ptr[1]);
+
+    // freed neighbours coalesce and land in a bigger class
+    assert(Mem_Free(ptr[2]) == 0);
+    assert(Mem_Free(test) == 0);
+    test = Mem_Alloc(400);
+    assert(test == ptr[1]);
+
+    printf("tlsf.c passes!\n");
+
+    exit(0);
+}
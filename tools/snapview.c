@@ -0,0 +1,225 @@
+/******************************************************************************
+ * FILENAME: snapview.c
+ * PROVIDES: Reads heap snapshots written by Mem_Snapshot / Mem_Arena_Snapshot
+ *           and shows how the free space of the heap was broken up over time.
+ *
+ * Every file may hold any number of snapshots back to back, in either
+ * format, so a program can keep appending snapshots to one file.  For each
+ * snapshot one line of totals is printed:
+ *
+ *     time        seconds since the first snapshot
+ *     in use      payload of the busy blocks, slab objects and large blocks
+ *     free        payload of the free blocks of the heap
+ *     largest     the largest free block
+ *     frag        1 - largest / free, as Mem_Fragmentation reports it
+ *
+ * followed by a histogram of the free block sizes in power of two classes,
+ * of the last snapshot only unless -a is given.
+ *
+ * usage: snapview [-a] snapshot...
+ * *****************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+#define CLASSES 32  // free blocks whose payload has its top bit at i
+#define BAR_WIDTH 40
+
+typedef struct SUMMARY {
+    long long time;
+    long long heap_size;
+    long long mapped_size;
+    long long in_use;
+    long long free;
+    long long largest;
+    unsigned free_blocks;
+    unsigned class_counts[CLASSES];
+    long long class_bytes[CLASSES];
+} SUMMARY;
+
+const char *status_names[] = {"free", "busy", "slab", "parked", "mapped"};
+long long first_time = -1;
+int all_histograms;
+
+/**
+ * @brief Adds a block to the totals of its snapshot
+ */
+void Summary_Add(SUMMARY *summary, MEM_SNAPSHOT_BLOCK *block) {
+    int cls;
+
+    if (block->status == MEM_BLOCK_FREE) {
+        cls = block->payload == 0 ? 0 : 31 - __builtin_clz(block->payload);
+        summary->free += block->payload;
+        summary->free_blocks++;
+        summary->class_counts[cls]++;
+        summary->class_bytes[cls] += block->payload;
+        if (block->payload > summary->largest) summary->largest = block->payload;
+    } else if (block->status != MEM_BLOCK_PARKED) {
+        summary->in_use += block->payload;
+    }
+}
+
+/**
+ * @brief Reads the next binary snapshot of a file
+ *
+ * @return  1 if a snapshot was read, 0 at the end of the file, -1 if it is cut short
+ */
+int Read_Binary(FILE *file, SUMMARY *summary) {
+    MEM_SNAPSHOT_HEADER header;
+    MEM_SNAPSHOT_BLOCK block;
+
+    if (fread(&header, sizeof(header), 1, file) != 1) return 0;
+    if (header.magic != MEM_SNAPSHOT_MAGIC) return -1;
+    summary->time = header.time;
+    summary->heap_size = header.heap_size;
+    summary->mapped_size = header.mapped_size;
+    for (unsigned i = 0; i < header.count; i++) {
+        if (fread(&block, sizeof(block), 1, file) != 1 || block.status > MEM_BLOCK_MAPPED)
+            return -1;
+        Summary_Add(summary, &block);
+    }
+    return 1;
+}
+
+/**
+ * @brief Reads the next JSON snapshot of a file, as Mem_Snapshot writes it
+ *
+ * @return  1 if a snapshot was read, 0 at the end of the file, -1 if it is malformed
+ */
+int Read_Json(FILE *file, SUMMARY *summary) {
+    MEM_SNAPSHOT_BLOCK block;
+    char line[256];
+    char status[16];
+    unsigned count;
+
+    do {
+        if (fgets(line, sizeof(line), file) == NULL) return 0;
+    } while (line[0] == '\n');
+    if (sscanf(line,
+               "{\"time\": %lld, \"policy\": %*d, \"heap_size\": %lld, \"mapped_size\": %lld, "
+               "\"count\": %u",
+               &summary->time, &summary->heap_size, &summary->mapped_size, &count) != 4)
+        return -1;
+
+    for (unsigned i = 0; i < count; i++) {
+        if (fgets(line, sizeof(line), file) == NULL ||
+            sscanf(line, "{\"offset\": %u, \"status\": \"%15[a-z]\", \"payload\": %u, "
+                         "\"padding\": %u}",
+                   &block.offset, status, &block.payload, &block.padding) != 4)
+            return -1;
+        for (block.status = MEM_BLOCK_FREE; block.status <= MEM_BLOCK_MAPPED; block.status++)
+            if (strcmp(status, status_names[block.status]) == 0) break;
+        if (block.status > MEM_BLOCK_MAPPED) return -1;
+        Summary_Add(summary, &block);
+    }
+    if (fgets(line, sizeof(line), file) == NULL || strcmp(line, "]}\n") != 0) return -1;
+    return 1;
+}
+
+/**
+ * @brief Prints the free block size histogram of a snapshot
+ */
+void Print_Histogram(SUMMARY *summary) {
+    long long most = 0;
+    int cls;
+
+    for (cls = 0; cls < CLASSES; cls++)
+        if (summary->class_bytes[cls] > most) most = summary->class_bytes[cls];
+    if (most == 0) {
+        printf("    no free blocks\n\n");
+        return;
+    }
+
+    printf("    %-22s %8s %12s\n", "free block size", "blocks", "bytes");
+    for (cls = 0; cls < CLASSES; cls++) {
+        char range[32];
+        int bar;
+
+        if (summary->class_counts[cls] == 0) continue;
+        snprintf(range, sizeof(range), "%u - %u", 1U << cls, (unsigned)((2ULL << cls) - 1));
+        bar = (int)((summary->class_bytes[cls] * BAR_WIDTH + most - 1) / most);
+        printf("    %-22s %8u %12lld %.*s\n", range, summary->class_counts[cls],
+               summary->class_bytes[cls], bar, "########################################");
+    }
+    printf("\n");
+}
+
+/**
+ * @brief Prints the totals of a snapshot, and its histogram if asked for
+ */
+void Print_Summary(SUMMARY *summary, int histogram) {
+    if (first_time < 0) first_time = summary->time;
+    printf("%10.3f %12lld %12lld %12lld %12lld %8u %12lld %7.2f%%\n",
+           (summary->time - first_time) / 1e9, summary->heap_size, summary->mapped_size,
+           summary->in_use, summary->free, summary->free_blocks, summary->largest,
+           summary->free ? 100.0 * (1.0 - (double)summary->largest / summary->free) : 0.0);
+    if (histogram) {
+        printf("\n");
+        Print_Histogram(summary);
+    }
+}
+
+int main(int argc, char **argv) {
+    SUMMARY summary;
+    SUMMARY last;
+    FILE *file;
+    int found = 0;
+    int result;
+    int c;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a")) != -1) {
+        switch (opt) {
+            case 'a': all_histograms = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-a] snapshot...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind == argc) {
+        fprintf(stderr, "usage: %s [-a] snapshot...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%10s %12s %12s %12s %12s %8s %12s %8s\n", "Time", "Heap", "Mapped", "In use", "Free",
+           "Blocks", "Largest", "Frag");
+    for (int i = optind; i < argc; i++) {
+        if ((file = fopen(argv[i], "r")) == NULL) {
+            fprintf(stderr, "snapview: %s: %s\n", argv[i], strerror(errno));
+            return 1;
+        }
+
+        // The first byte tells the formats apart, JSON snapshots open with a brace
+        for (;;) {
+            memset(&summary, 0, sizeof(summary));
+            if ((c = getc(file)) == EOF) break;
+            ungetc(c, file);
+            result = c == '{' || c == '\n' ? Read_Json(file, &summary)
+                                           : Read_Binary(file, &summary);
+            if (result == 0) break;
+            if (result < 0) {
+                fprintf(stderr, "snapview: %s: not a heap snapshot, or cut short\n", argv[i]);
+                fclose(file);
+                return 1;
+            }
+            found++;
+            last = summary;
+            Print_Summary(&summary, all_histograms);
+        }
+        fclose(file);
+    }
+    if (found == 0) {
+        fprintf(stderr, "snapview: no snapshots\n");
+        return 1;
+    }
+    if (!all_histograms) {
+        printf("\n");
+        Print_Histogram(&last);
+    }
+    return 0;
+}